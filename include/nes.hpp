@@ -5,6 +5,8 @@
 #define NES_WIDTH  256
 #define NES_HEIGHT 240
 
+#define NES_FPS 60.0988 // ntsc, 89342 dots at 5.369 MHz
+
 #define A_BUTTON        (1 << 0)
 #define B_BUTTON        (1 << 1)
 #define SELECT_BUTTON   (1 << 2)
@@ -0,0 +1,104 @@
+#include "audio_output.hpp"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+AudioOutput audio;
+
+bool AudioOutput::Open(int wantRate) {
+    Close();
+
+    SDL_AudioSpec want{}, have{};
+    want.freq = wantRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = Callback;
+    want.userdata = this;
+
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!device) {
+        std::cerr << "Failed to open audio: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    rate = have.freq;
+    deviceSamples = have.samples;
+    target = std::min<size_t>(size_t(rate) * AUDIO_TARGET_MS / 1000, AUDIO_RING_SIZE / 2);
+
+    // start out at the target so the first frames don't have to catch up
+    ring.Clear();
+    std::vector<int16_t> silence(target, 0);
+    ring.Write(silence.data(), silence.size());
+
+    consumed = SDL_CreateSemaphore(0);
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void AudioOutput::Close() {
+    if (device) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+    if (consumed) {
+        SDL_DestroySemaphore(consumed);
+        consumed = nullptr;
+    }
+}
+
+void AudioOutput::Push(const int16_t* samples, size_t count) {
+    if (!device) return;
+    ring.Write(samples, count); // whatever doesn't fit is dropped, the rate control backs off
+    feeding.store(true, std::memory_order_relaxed);
+}
+
+double AudioOutput::FillRatio() const {
+    if (!device || target == 0) return 1.0;
+    return double(ring.Size()) / double(target);
+}
+
+double AudioOutput::RateRatio() const {
+    double fill = FillRatio();
+    double ratio = 1.0 + AUDIO_MAX_RATE_DELTA * (1.0 - fill);
+    return std::clamp(ratio, 1.0 - AUDIO_MAX_RATE_DELTA, 1.0 + AUDIO_MAX_RATE_DELTA);
+}
+
+bool AudioOutput::WaitForRoom(uint32_t timeoutMs) {
+    if (!device || !consumed) return false;
+    const uint64_t deadline = SDL_GetTicks64() + timeoutMs;
+    // posts pile up while nobody waits, so a wakeup only means "look again"
+    while (ring.Size() >= target) {
+        uint64_t now = SDL_GetTicks64();
+        if (now >= deadline) return false;
+        if (SDL_SemWaitTimeout(consumed, Uint32(deadline - now)) == SDL_MUTEX_TIMEDOUT) {
+            return ring.Size() < target;
+        }
+    }
+    return true;
+}
+
+double AudioOutput::LatencyMs() const {
+    if (!device) return 0;
+    return double(ring.Size() + deviceSamples) * 1000.0 / rate;
+}
+
+void AudioOutput::Callback(void* user, Uint8* stream, int len) {
+    AudioOutput* self = static_cast<AudioOutput*>(user);
+    int16_t* out = reinterpret_cast<int16_t*>(stream);
+    size_t want = size_t(len) / sizeof(int16_t);
+
+    size_t got = self->ring.Read(out, want);
+    if (got > 0) self->last = out[got - 1];
+
+    if (got < want) {
+        std::fill(out + got, out + want, self->last);
+        // only a stream that is being fed can underrun, an idle one is just quiet
+        if (self->feeding.exchange(false, std::memory_order_relaxed)) {
+            self->underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (self->consumed) SDL_SemPost(self->consumed);
+}
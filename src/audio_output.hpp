@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <SDL2/SDL.h>
+
+#include "audio_ring.hpp"
+
+#define AUDIO_RING_SIZE      4096 // samples, power of two
+#define AUDIO_DEVICE_SAMPLES 512  // ~11 ms at 48 kHz
+#define AUDIO_TARGET_MS      20   // ring fill dynamic rate control steers to
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+// SDL callback output fed from a lock-free ring. the emulation thread pushes
+// whole frames of samples and asks RateRatio() how much faster or slower to
+// generate the next one, which keeps the ring hovering around its target
+// instead of slowly draining (crackle) or filling up (latency).
+class AudioOutput {
+public:
+    AudioOutput() : ring(AUDIO_RING_SIZE) {}
+
+    bool Open(int rate = 48000);
+    void Close();
+
+    void Push(const int16_t* samples, size_t count);
+
+    // multiplier for the nominal sample rate, 1 +- AUDIO_MAX_RATE_DELTA
+    double RateRatio() const;
+
+    // ring fill relative to the target, 1 is right on it
+    double FillRatio() const;
+
+    // for audio clocked sync: whether the ring is below its target, and a
+    // sleep until it is (woken by the callback, false on timeout)
+    bool NeedsSamples() const { return device && ring.Size() < target; }
+    bool WaitForRoom(uint32_t timeoutMs);
+
+    int SampleRate() const { return rate; }
+    bool IsOpen() const { return device != 0; }
+    size_t Buffered() const { return ring.Size(); }
+    double LatencyMs() const;
+    uint32_t Underruns() const { return underruns.load(std::memory_order_relaxed); }
+
+private:
+    static void Callback(void* user, Uint8* stream, int len);
+
+    AudioRing<int16_t> ring;
+    SDL_AudioDeviceID device = 0;
+    SDL_sem* consumed = nullptr; // posted by every callback
+    int rate = 0;
+    int deviceSamples = 0;
+    size_t target = 0;
+    int16_t last = 0; // callback only, held through underruns instead of clicking to 0
+    std::atomic<uint32_t> underruns{0};
+    std::atomic<bool> feeding{false};
+};
+
+extern AudioOutput audio;
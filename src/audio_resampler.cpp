@@ -0,0 +1,180 @@
+#include "audio_resampler.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define RESAMPLER_X86
+#include <immintrin.h>
+#endif
+
+#define RESAMPLER_KAISER_BETA 8.0
+
+static const double pi = 3.14159265358979323846;
+
+// zeroth order modified bessel function, for the kaiser window
+static double BesselI0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+static void DotScalar(const float* in, const float* a, const float* b, float* ra, float* rb) {
+    float sa = 0, sb = 0;
+    for (int i = 0; i < RESAMPLER_TAPS; i++) {
+        sa += in[i] * a[i];
+        sb += in[i] * b[i];
+    }
+    *ra = sa;
+    *rb = sb;
+}
+
+#ifdef RESAMPLER_X86
+static float HorizontalSum(__m128 v) {
+    __m128 hi = _mm_movehl_ps(v, v);
+    v = _mm_add_ps(v, hi);
+    hi = _mm_shuffle_ps(v, v, 1);
+    return _mm_cvtss_f32(_mm_add_ss(v, hi));
+}
+
+static void DotSSE(const float* in, const float* a, const float* b, float* ra, float* rb) {
+    __m128 sa = _mm_setzero_ps(), sb = _mm_setzero_ps();
+    for (int i = 0; i < RESAMPLER_TAPS; i += 4) {
+        __m128 x = _mm_loadu_ps(in + i);
+        sa = _mm_add_ps(sa, _mm_mul_ps(x, _mm_load_ps(a + i)));
+        sb = _mm_add_ps(sb, _mm_mul_ps(x, _mm_load_ps(b + i)));
+    }
+    *ra = HorizontalSum(sa);
+    *rb = HorizontalSum(sb);
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx")))
+static void DotAVX(const float* in, const float* a, const float* b, float* ra, float* rb) {
+    __m256 sa = _mm256_setzero_ps(), sb = _mm256_setzero_ps();
+    for (int i = 0; i < RESAMPLER_TAPS; i += 8) {
+        __m256 x = _mm256_loadu_ps(in + i);
+        sa = _mm256_add_ps(sa, _mm256_mul_ps(x, _mm256_load_ps(a + i)));
+        sb = _mm256_add_ps(sb, _mm256_mul_ps(x, _mm256_load_ps(b + i)));
+    }
+    __m128 la = _mm_add_ps(_mm256_castps256_ps128(sa), _mm256_extractf128_ps(sa, 1));
+    __m128 lb = _mm_add_ps(_mm256_castps256_ps128(sb), _mm256_extractf128_ps(sb, 1));
+    *ra = HorizontalSum(la);
+    *rb = HorizontalSum(lb);
+}
+#endif
+#endif
+
+AudioResampler::AudioResampler() {
+    dot = DotScalar;
+#ifdef RESAMPLER_X86
+    dot = DotSSE;
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx")) dot = DotAVX;
+#endif
+#endif
+    SetRates(48000, 48000);
+}
+
+void AudioResampler::SetRates(double in, double out) {
+    inRate = in;
+
+    // cutoff in cycles per input sample, a bit under nyquist of whichever side is lower
+    const double cutoff = 0.5 * std::min(1.0, out / in) * 0.9;
+    const double center = RESAMPLER_TAPS / 2 - 1;
+    const double i0Beta = BesselI0(RESAMPLER_KAISER_BETA);
+
+    // one extra phase so phase p + 1 always exists for the interpolation
+    for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+        float* h = &kernel[p * RESAMPLER_TAPS];
+        double frac = double(p) / RESAMPLER_PHASES;
+        double sum = 0;
+        for (int i = 0; i < RESAMPLER_TAPS; i++) {
+            double x = i - center - frac;
+            double s = x == 0 ? 1.0 : std::sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+            double r = x / (RESAMPLER_TAPS / 2);
+            double w = std::fabs(r) >= 1 ? 0 : BesselI0(RESAMPLER_KAISER_BETA * std::sqrt(1 - r * r)) / i0Beta;
+            h[i] = float(s * w);
+            sum += h[i];
+        }
+        // unity gain at dc for every phase, or the phase walk would modulate it
+        for (int i = 0; i < RESAMPLER_TAPS; i++) h[i] = float(h[i] / sum);
+    }
+
+    // first order RC sections, coefficients from the input rate
+    const double dt = 1.0 / in;
+    auto highPass = [&](double hz) { double rc = 1 / (2 * pi * hz); return float(rc / (rc + dt)); };
+    auto lowPass = [&](double hz) { double rc = 1 / (2 * pi * hz); return float(dt / (rc + dt)); };
+    hp90 = highPass(90);
+    hp440 = highPass(440);
+    lp = lowPass(14000);
+
+    AdjustOutputRate(out);
+    Clear();
+}
+
+void AudioResampler::AdjustOutputRate(double out) {
+    outRate = out;
+    step = uint64_t(inRate / outRate * 4294967296.0);
+}
+
+void AudioResampler::Clear() {
+    hp90Prev = hp90Out = 0;
+    hp440Prev = hp440Out = 0;
+    lpOut = 0;
+
+    // half a kernel of silence, so the first input lands in the middle of the window
+    fill = RESAMPLER_TAPS / 2;
+    std::fill(buf, buf + fill, 0.0f);
+    pos = 0;
+}
+
+size_t AudioResampler::Write(const int16_t* in, size_t count) {
+    count = std::min(count, Room());
+    for (size_t i = 0; i < count; i++) {
+        float x = in[i];
+
+        hp90Out = hp90 * (hp90Out + x - hp90Prev);
+        hp90Prev = x;
+        hp440Out = hp440 * (hp440Out + hp90Out - hp440Prev);
+        hp440Prev = hp90Out;
+        lpOut += lp * (hp440Out - lpOut);
+
+        buf[fill + i] = lpOut;
+    }
+    fill += count;
+    return count;
+}
+
+size_t AudioResampler::Read(int16_t* out, size_t max) {
+    const int phaseShift = 32 - RESAMPLER_PHASE_BITS;
+
+    size_t n = 0;
+    while (n < max) {
+        size_t idx = size_t(pos >> 32);
+        if (idx + RESAMPLER_TAPS > fill) break;
+
+        uint32_t frac = uint32_t(pos);
+        uint32_t phase = frac >> phaseShift;
+        float t = float(frac & ((1u << phaseShift) - 1)) * (1.0f / (1u << phaseShift));
+
+        float a, b;
+        dot(buf + idx, &kernel[phase * RESAMPLER_TAPS], &kernel[(phase + 1) * RESAMPLER_TAPS], &a, &b);
+        float v = a + (b - a) * t;
+        out[n++] = int16_t(std::clamp(std::lround(v), -32768L, 32767L));
+
+        pos += step;
+    }
+
+    // drop what no future output can reach
+    size_t used = std::min(size_t(pos >> 32), fill);
+    std::memmove(buf, buf + used, (fill - used) * sizeof(float));
+    fill -= used;
+    pos -= uint64_t(used) << 32;
+    return n;
+}
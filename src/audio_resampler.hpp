@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#define RESAMPLER_TAPS 32 // per phase, multiple of 8 for the avx loop
+#define RESAMPLER_PHASE_BITS 7
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASE_BITS) // neighbouring phases are interpolated
+#define RESAMPLER_BUFFER 4096 // input samples held at most
+
+// windowed sinc polyphase resampler with the NES output filters in front of
+// it (high pass at 90 and 440 Hz, low pass at 14 kHz, all first order like
+// the real RC network). everything lives in fixed arrays, nothing allocates
+// after construction. the dot products run on sse or avx, picked at runtime.
+class AudioResampler {
+public:
+    AudioResampler();
+
+    // rebuilds the kernel, the cutoff follows the lower of the two rates
+    void SetRates(double inRate, double outRate);
+
+    // only changes the step, for rate control. the kernel stays as it is
+    void AdjustOutputRate(double outRate);
+
+    void Clear();
+
+    // filters and queues input, returns how much fit
+    size_t Write(const int16_t* in, size_t count);
+    size_t Room() const { return RESAMPLER_BUFFER - fill; }
+
+    // produces as many samples as the queued input allows, up to max
+    size_t Read(int16_t* out, size_t max);
+
+private:
+    typedef void (*DotFunc)(const float* in, const float* a, const float* b, float* ra, float* rb);
+
+    double inRate = 0;
+    double outRate = 0;
+    uint64_t step = 0; // input samples per output sample, 32.32 fixed point
+    uint64_t pos = 0;  // position of the next output in buf, 32.32
+    size_t fill = 0;
+
+    // filter state
+    float hp90Prev = 0, hp90Out = 0;
+    float hp440Prev = 0, hp440Out = 0;
+    float lpOut = 0;
+    float hp90 = 0, hp440 = 0, lp = 0;
+
+    DotFunc dot = nullptr;
+
+    alignas(32) float kernel[(RESAMPLER_PHASES + 1) * RESAMPLER_TAPS];
+    alignas(32) float buf[RESAMPLER_BUFFER];
+};
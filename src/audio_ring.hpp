@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// single producer / single consumer ring. both ends are wait-free: the
+// emulation thread only ever moves head, the audio callback only moves tail.
+// capacity has to be a power of two.
+template <typename T>
+class AudioRing {
+public:
+    explicit AudioRing(size_t capacity) : buf(capacity), mask(capacity - 1) {}
+
+    size_t Capacity() const { return buf.size(); }
+
+    size_t Size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // producer side, returns how many fit
+    size_t Write(const T* data, size_t count) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        count = std::min(count, buf.size() - (h - t));
+
+        size_t first = std::min(count, buf.size() - (h & mask));
+        std::memcpy(&buf[h & mask], data, first * sizeof(T));
+        std::memcpy(&buf[0], data + first, (count - first) * sizeof(T));
+
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer side, returns how many were there
+    size_t Read(T* data, size_t count) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        count = std::min(count, h - t);
+
+        size_t first = std::min(count, buf.size() - (t & mask));
+        std::memcpy(data, &buf[t & mask], first * sizeof(T));
+        std::memcpy(data + first, &buf[0], (count - first) * sizeof(T));
+
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer side
+    void Clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+private:
+    std::vector<T> buf;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
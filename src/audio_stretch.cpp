@@ -0,0 +1,132 @@
+#include "audio_stretch.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#define STRETCH_BUFFER_WINDOWS 24 // input queue size, enough for a full hop at max speed plus slack
+
+void AudioStretch::SetSampleRate(int rate) {
+    const double pi = 3.14159265358979323846;
+
+    window = (rate * STRETCH_WINDOW_MS / 1000) & ~1;
+    hop = window / 2;
+    seek = rate * STRETCH_SEEK_MS / 1000;
+
+    // periodic hann, two of them half a window apart add up to exactly 1
+    hann.resize(window);
+    for (int i = 0; i < window; i++) hann[i] = float(0.5 - 0.5 * std::cos(2 * pi * i / window));
+
+    in.assign(size_t(window) * STRETCH_BUFFER_WINDOWS, 0.0f);
+    tail.assign(hop, 0.0f);
+    Clear();
+}
+
+void AudioStretch::SetSpeed(double s) {
+    speed = std::clamp(s, STRETCH_MIN_SPEED, STRETCH_MAX_SPEED);
+}
+
+void AudioStretch::Clear() {
+    // the first window needs room to slide left
+    fill = seek;
+    std::fill(in.begin(), in.begin() + fill, 0.0f);
+    std::fill(tail.begin(), tail.end(), 0.0f);
+    next = seek;
+    follow = 0;
+    primed = false;
+}
+
+void AudioStretch::Write(const int16_t* data, size_t count) {
+    if (in.empty()) return;
+
+    if (count > in.size()) {
+        data += count - in.size();
+        count = in.size();
+    }
+
+    // overflow: forget the oldest input and start lining up from scratch
+    if (fill + count > in.size()) {
+        size_t drop = fill + count - in.size();
+        std::memmove(in.data(), in.data() + drop, (fill - drop) * sizeof(float));
+        fill -= drop;
+        next = std::max(next - double(drop), double(seek));
+        primed = false;
+    }
+
+    for (size_t i = 0; i < count; i++) in[fill + i] = data[i];
+    fill += count;
+}
+
+// best start for the window nominally at `nominal`: the one whose first half
+// looks most like what would have followed the previous window. a coarse pass
+// over every other lag and sample, then the neighbours of the winner
+size_t AudioStretch::Search(size_t nominal) const {
+    const float* target = &in[follow];
+
+    auto score = [&](size_t start, int stride) {
+        const float* cand = &in[start];
+        float corr = 0, energy = 1e-3f;
+        for (int i = 0; i < hop; i += stride) {
+            corr += target[i] * cand[i];
+            energy += cand[i] * cand[i];
+        }
+        return corr / std::sqrt(energy);
+    };
+
+    size_t best = nominal;
+    float bestScore = -1e30f;
+    for (size_t s = nominal - seek; s <= nominal + seek; s += 2) {
+        float v = score(s, 2);
+        if (v > bestScore) {
+            bestScore = v;
+            best = s;
+        }
+    }
+
+    size_t coarse = best;
+    bestScore = -1e30f;
+    for (size_t s = std::max(coarse - 1, nominal - seek); s <= std::min(coarse + 1, nominal + seek); s++) {
+        float v = score(s, 1);
+        if (v > bestScore) {
+            bestScore = v;
+            best = s;
+        }
+    }
+    return best;
+}
+
+size_t AudioStretch::Read(int16_t* out, size_t max) {
+    size_t n = 0;
+    while (n + hop <= max) {
+        size_t nominal = size_t(next);
+        if (nominal + seek + window > fill) break;
+
+        size_t start = primed ? Search(nominal) : nominal;
+        for (int i = 0; i < hop; i++) {
+            float v = tail[i] + in[start + i] * hann[i];
+            out[n + i] = int16_t(std::clamp(std::lround(v), -32768L, 32767L));
+            tail[i] = in[start + hop + i] * hann[hop + i];
+        }
+
+        follow = start + hop;
+        primed = true;
+        next += hop * speed;
+        n += hop;
+    }
+
+    Discard();
+    return n;
+}
+
+// drops input that neither the next search template nor the next window can reach
+void AudioStretch::Discard() {
+    size_t drop = size_t(next) - seek;
+    if (primed) drop = std::min(drop, follow);
+    drop = std::min(drop, fill);
+    if (drop == 0) return;
+
+    std::memmove(in.data(), in.data() + drop, (fill - drop) * sizeof(float));
+    fill -= drop;
+    next -= double(drop);
+    if (primed) follow -= drop;
+}
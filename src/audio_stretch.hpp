@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define STRETCH_WINDOW_MS 20 // analysis/synthesis window, overlapped by half
+#define STRETCH_SEEK_MS   5  // how far a window may slide to line up with the last one
+#define STRETCH_MIN_SPEED 0.25
+#define STRETCH_MAX_SPEED 8.0
+
+// WSOLA time stretching. the output is cut from the input in overlapping
+// windows taken every speed * hop samples, and each window is slid within
+// +-seek to wherever it best continues the previous one, so the waveform
+// lines up and pitch stays put. the work per output hop is fixed (one coarse
+// and one fine correlation search), so the cost scales with the samples
+// that come out, not with how fast emulation runs.
+class AudioStretch {
+public:
+    void SetSampleRate(int rate);
+    void SetSpeed(double speed);
+    double Speed() const { return speed; }
+
+    void Clear();
+
+    // queues input. if more arrives than can be consumed the oldest goes
+    void Write(const int16_t* in, size_t count);
+
+    // produces whatever the queued input allows, up to max
+    size_t Read(int16_t* out, size_t max);
+
+private:
+    double speed = 1.0;
+    int window = 0;  // samples, even
+    int hop = 0;     // window / 2, also the output produced per step
+    int seek = 0;
+
+    std::vector<float> hann;
+    std::vector<float> in;    // queued input, capacity fixed in SetSampleRate
+    std::vector<float> tail;  // second half of the last window, waiting to be overlapped
+    size_t fill = 0;
+    double next = 0;          // nominal start of the next window in `in`
+    size_t follow = 0;        // where the input continues past the last window's first half
+    bool primed = false;
+
+    size_t Search(size_t nominal) const;
+    void Discard();
+};
@@ -0,0 +1,106 @@
+#include "blip_buffer.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#define BLIP_BUFFER_SIZE 16384 // samples, a good deal more than one frame
+#define BLIP_KERNEL_UNIT 15    // kernel phases sum to 1 << 15
+#define BLIP_BASS_SHIFT  9     // dc blocker, ~17 Hz at the apu native rate
+
+struct BlipKernel {
+    int32_t taps[BLIP_PHASES][BLIP_TAPS];
+
+    BlipKernel() {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.45; // of the output rate, leaves room for the window's rolloff
+        const double center = BLIP_TAPS / 2 - 1;
+
+        for (int p = 0; p < BLIP_PHASES; p++) {
+            double frac = double(p) / BLIP_PHASES;
+            double h[BLIP_TAPS];
+            double sum = 0;
+            for (int i = 0; i < BLIP_TAPS; i++) {
+                double x = i - center - frac;
+                double s = x == 0 ? 1.0 : std::sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+                double w = (x + BLIP_TAPS / 2) / BLIP_TAPS; // blackman over the tap span
+                double win = 0.42 - 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w);
+                h[i] = s * std::max(win, 0.0);
+                sum += h[i];
+            }
+            // every phase has to add up exactly, or steps would leave dc behind
+            int32_t total = 0;
+            int peak = 0;
+            for (int i = 0; i < BLIP_TAPS; i++) {
+                taps[p][i] = int32_t(std::lround(h[i] / sum * (1 << BLIP_KERNEL_UNIT)));
+                total += taps[p][i];
+                if (taps[p][i] > taps[p][peak]) peak = i;
+            }
+            taps[p][peak] += (1 << BLIP_KERNEL_UNIT) - total;
+        }
+    }
+};
+
+static const BlipKernel& Kernel() {
+    static const BlipKernel kernel;
+    return kernel;
+}
+
+BlipBuffer::BlipBuffer() : buf(BLIP_BUFFER_SIZE + BLIP_TAPS, 0) {
+    Kernel();
+}
+
+void BlipBuffer::SetRates(double clock, double rate) {
+    clockRate = clock;
+    AdjustSampleRate(rate);
+    Clear();
+}
+
+void BlipBuffer::AdjustSampleRate(double rate) {
+    sampleRate = rate;
+    factor = uint64_t(std::llround(rate / clockRate * 4294967296.0));
+}
+
+void BlipBuffer::Clear() {
+    offset = 0;
+    avail = 0;
+    integrator = 0;
+    std::fill(buf.begin(), buf.end(), 0);
+}
+
+void BlipBuffer::AddDelta(uint32_t time, int delta) {
+    uint64_t pos = offset + time * factor;
+    size_t index = size_t(pos >> 32);
+    if (index >= BLIP_BUFFER_SIZE) return; // frame ran way too long, drop it
+
+    const int32_t* k = Kernel().taps[(pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+    int64_t* out = &buf[index];
+    for (int i = 0; i < BLIP_TAPS; i++) out[i] += int64_t(k[i]) * delta;
+}
+
+void BlipBuffer::EndFrame(uint32_t time) {
+    offset += time * factor;
+    if ((offset >> 32) > BLIP_BUFFER_SIZE) {
+        offset = (uint64_t(BLIP_BUFFER_SIZE) << 32) | (offset & 0xFFFFFFFF);
+    }
+    avail = size_t(offset >> 32);
+}
+
+size_t BlipBuffer::ReadSamples(int16_t* out, size_t max) {
+    size_t count = std::min(max, avail);
+
+    for (size_t i = 0; i < count; i++) {
+        integrator += buf[i];
+        int64_t s = integrator >> BLIP_KERNEL_UNIT;
+        integrator -= integrator >> BLIP_BASS_SHIFT;
+        out[i] = int16_t(std::clamp<int64_t>(s, -32768, 32767));
+    }
+
+    // only the part the kernels can have touched needs to move down
+    size_t used = std::min(buf.size(), size_t(offset >> 32) + BLIP_TAPS);
+    std::memmove(buf.data(), buf.data() + count, (used - count) * sizeof(int64_t));
+    std::fill(buf.begin() + (used - count), buf.begin() + used, 0);
+    offset -= uint64_t(count) << 32;
+    avail -= count;
+    return count;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+
+// band limited step synthesis. callers only report *when* and *by how much*
+// the amplitude changes (in source clocks since the start of the frame), each
+// change drops a windowed sinc impulse into a delta buffer and ReadSamples()
+// integrates it back into a waveform. work is per change, not per clock.
+class BlipBuffer {
+public:
+    BlipBuffer();
+
+    void SetRates(double clockRate, double sampleRate);
+    void Clear();
+
+    // changes the output rate without dropping anything, for rate control
+    void AdjustSampleRate(double sampleRate);
+
+    void AddDelta(uint32_t time, int delta);
+
+    // everything before time is final, samples up to there become readable
+    void EndFrame(uint32_t time);
+
+    size_t SamplesAvail() const { return avail; }
+    size_t ReadSamples(int16_t* out, size_t max);
+
+    double SampleRate() const { return sampleRate; }
+
+private:
+    double clockRate = 0;
+    double sampleRate = 0;
+    uint64_t factor = 0; // output samples per clock, 32.32 fixed point
+    uint64_t offset = 0; // fractional sample position of the frame start
+    size_t avail = 0;
+    int64_t integrator = 0;
+    std::vector<int64_t> buf;
+};
@@ -0,0 +1,114 @@
+#include "lz_codec.hpp"
+
+#include <cstring>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_LAST_LITERALS 5 // the end of a block is always literals, matches stop short of it
+#define LZ_MATCH_LIMIT 12  // no match starts in the last this many bytes
+
+static uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static void PutLength(std::vector<uint8_t>& out, size_t extra) {
+    while (extra >= 255) {
+        out.push_back(255);
+        extra -= 255;
+    }
+    out.push_back(uint8_t(extra));
+}
+
+// literals, then a match of matchLen at offset back (none when matchLen is 0)
+static void PutSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalLen, size_t offset, size_t matchLen) {
+    size_t m = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    out.push_back(uint8_t((literalLen < 15 ? literalLen : 15) << 4 | (m < 15 ? m : 15)));
+    if (literalLen >= 15) PutLength(out, literalLen - 15);
+    out.insert(out.end(), literals, literals + literalLen);
+    if (!matchLen) return;
+    out.push_back(uint8_t(offset));
+    out.push_back(uint8_t(offset >> 8));
+    if (m >= 15) PutLength(out, m - 15);
+}
+
+void LZCompress(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+    uint32_t table[1 << LZ_HASH_BITS] = {}; // last position of each 4 byte hash
+    size_t pos = 0, anchor = 0;
+    size_t misses = 0;
+
+    if (size > LZ_MATCH_LIMIT) {
+        size_t limit = size - LZ_MATCH_LIMIT;
+        while (pos < limit) {
+            uint32_t seq = Read32(src + pos);
+            uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+            size_t ref = table[h];
+            table[h] = uint32_t(pos);
+
+            if (ref >= pos || pos - ref > LZ_MAX_OFFSET || Read32(src + ref) != seq) {
+                pos += 1 + (misses++ >> 6); // skips ahead faster through data that won't pack
+                continue;
+            }
+            misses = 0;
+
+            size_t len = LZ_MIN_MATCH;
+            size_t end = size - LZ_LAST_LITERALS;
+            while (pos + len < end && src[ref + len] == src[pos + len]) len++;
+
+            PutSequence(out, src + anchor, pos - anchor, pos - ref, len);
+            pos += len;
+            anchor = pos;
+        }
+    }
+    PutSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+// a length continued in extra bytes, false past the end
+static bool GetLength(const uint8_t*& p, const uint8_t* end, size_t& len) {
+    uint8_t b;
+    do {
+        if (p >= end) return false;
+        b = *p++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool LZDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize) {
+    const uint8_t* p = src;
+    const uint8_t* end = src + size;
+    size_t out = 0;
+
+    while (p < end) {
+        uint8_t token = *p++;
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !GetLength(p, end, literalLen)) return false;
+        if (literalLen > size_t(end - p) || literalLen > dstSize - out) return false;
+        std::memcpy(dst + out, p, literalLen);
+        p += literalLen;
+        out += literalLen;
+
+        if (p == end) break; // the last sequence has no match
+
+        if (end - p < 2) return false;
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !GetLength(p, end, matchLen)) return false;
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || matchLen > dstSize - out) return false;
+
+        // the match may overlap what it writes, a run of one byte repeated is offset 1
+        const uint8_t* from = dst + out - offset;
+        if (offset >= matchLen) {
+            std::memcpy(dst + out, from, matchLen);
+        } else {
+            for (size_t i = 0; i < matchLen; i++) dst[out + i] = from[i];
+        }
+        out += matchLen;
+    }
+    return out == dstSize;
+}
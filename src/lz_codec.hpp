@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// byte oriented LZ77 in the LZ4 block layout: a token with the literal and
+// match lengths, the literals, a 16 bit offset back, longer lengths spilling
+// into extra bytes. no entropy stage, so it runs at memcpy-like speed and a
+// console state (mostly zeros and repeated tiles) still shrinks several times
+
+// appends the packed form of src to out
+void LZCompress(const uint8_t* src, size_t size, std::vector<uint8_t>& out);
+
+// false unless src unpacks to exactly dstSize bytes. never reads or writes
+// out of bounds, whatever src holds
+bool LZDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize);
@@ -7,16 +7,262 @@
 #include "imgui/backends/imgui_impl_sdlrenderer2.h"
 
 #include "main.hpp"
+#include "audio_output.hpp"
+#include "audio_stretch.hpp"
+#include "nes_nsf.hpp"
+#include "nes_rewind.hpp"
+#include "nes_netplay.hpp"
+#include "nes_bisect.hpp"
+#include "nes_tas.hpp"
+#include "nes_video.hpp"
+#include "nes_movie.hpp"
+#include "nes_savestate.hpp"
 
 NesROM globalROM;
 
 bool romIsLoaded = false;
 static bool fullscreen = false;
 static bool unlimitFPS = false;
+static bool soundEnabled = true;
+static bool drawPicture = true; // off: RAM only, the PPU keeps time but nothing is drawn or uploaded
+
+// what paces emulation: the wall clock, or the audio device draining the ring
+enum SyncMode { SYNC_TIMER, SYNC_AUDIO };
+static int syncMode = SYNC_TIMER;
+static const char* SyncModes[] = { "Timer", "Audio" };
+
+#define AUDIO_SYNC_MAX_FRAMES 4 // most frames emulated per presented one
+
+static uint32_t framesDuplicated = 0;
+static uint32_t framesDropped = 0;
+
+// emulation speed relative to the console. anything off 1x (or unlimited)
+// goes through the time stretcher so the sound keeps its pitch
+static const float Speeds[] = { 0.25f, 0.5f, 1.0f, 2.0f, 4.0f };
+static const char* SpeedNames[] = { "0.25x", "0.5x", "1x", "2x", "4x" };
+static int speedIndex = 2;
+static bool turbo = false;         // Tab held, runs unlimited
+static double measuredSpeed = 1.0; // frames actually emulated per second / NES_FPS
+
+static AudioStretch stretch;
+static bool stretching = false;
+
+// run-ahead: every host frame the next few frames are emulated with the
+// current input, the last of them is shown and then they're thrown away. that
+// hides the frames of lag the game itself has before it reacts to a button.
+// the hidden frames are timing only, they make no sound and are never drawn
+#define RUNAHEAD_MAX_FRAMES 4
+static int runAheadFrames = 0;
+static std::vector<uint8_t> runAheadState;
+static double runAheadMs = 0;
+
+static RewindBuffer rewindBuffer;
+static bool rewindEnabled = true;
+static bool rewinding = false; // Backspace held, steps back one frame per frame
+
+// rollback netplay, both sides run at exactly 1x and can't pause or rewind
+static NetplaySession netplay;
+static char netPeerHost[64] = "127.0.0.1";
+static int netPeerPort = NETPLAY_DEFAULT_PORT + 1;
+static int netLocalPort = NETPLAY_DEFAULT_PORT;
+static int netPlayer = 0;
+static int netDelay = 2;
+static int netLatency = 0;
+static float netLoss = 0;
+static const char* NetPlayers[] = { "1", "2" };
+
+// a movie replays exactly only if nothing but the pads steers the game, so
+// rewind, reset and netplay are off while one is open
+static MovieWriter movieWriter;
+static MoviePlayer moviePlayer;
+static int movieSeekFrame = 0;
+
+static bool MovieOpen() { return movieWriter.IsOpen() || moviePlayer.IsOpen(); }
+
+static std::string romPath;
+static int stateSlot = 1; // F5 saves to it, F9 loads it
+
+static bool CanLoadState() { return romIsLoaded && !netplay.IsOpen() && !MovieOpen(); }
+
+static void SaveStateSlot(int slot) {
+    stateSaver.Save(console, StatePathForROM(romPath, slot));
+    stateSlot = slot;
+}
+
+static void LoadStateSlot(int slot) {
+    stateSaver.Wait(); // it may still be on its way to disk
+    if (LoadStateFile(console, StatePathForROM(romPath, slot))) stateSlot = slot;
+}
+
+// state hash of every shown frame, the log lines up with --hash-log's
+static uint64_t stateHash = 0;
+static uint64_t hashFrame = 0;
+static std::ofstream hashLog;
+
+static bool Unlimited() { return (unlimitFPS || turbo) && !netplay.IsOpen(); }
+static double Speed() { return netplay.IsOpen() ? 1.0 : Speeds[speedIndex]; }
+
+// counts emulated frames over quarter second windows
+static void MeasureSpeed() {
+    static uint64_t start = 0;
+    static int frames = 0;
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (start == 0 || now - start > freq) {
+        start = now; // first frame, or a long pause in between
+        frames = 0;
+        return;
+    }
+    frames++;
+    if (now - start >= freq / 4) {
+        double fps = frames * double(freq) / double(now - start);
+        measuredSpeed = fps / NES_FPS;
+        start = now;
+        frames = 0;
+    }
+}
+
+static void PushAudio() {
+    static int16_t samples[4096];
+    static int16_t stretched[16384];
+    size_t count = apu.ReadSamples(samples, 4096);
+    if (!audio.IsOpen()) return;
+
+    if (!soundEnabled) std::fill(samples, samples + count, 0);
+
+    if (!Unlimited() && Speed() == 1.0) {
+        if (stretching) stretch.Clear();
+        stretching = false;
+        audio.Push(samples, count);
+    } else {
+        double speed = Speed();
+        if (Unlimited()) {
+            // the measured speed is only an estimate, the ring fill corrects the rest
+            speed = measuredSpeed * std::clamp(audio.FillRatio(), 0.5, 2.0);
+        }
+        stretching = true;
+        stretch.SetSpeed(speed);
+        stretch.Write(samples, count);
+        audio.Push(stretched, stretch.Read(stretched, 16384));
+    }
+    // with audio sync the device clock already sets the pace, there is no drift to correct
+    double ratio = syncMode == SYNC_AUDIO ? 1.0 : audio.RateRatio();
+    apu.AdjustSampleRate(audio.SampleRate() * ratio);
+}
+
+static void EmulateFrame() {
+    if (!console.CPUPaused) {
+        if (moviePlayer.IsOpen() && !moviePlayer.Apply(console)) {
+            moviePlayer.Close();
+            console.CPUPaused = true; // the last frame of the movie stays up
+            return;
+        }
+        movieWriter.Record(console);
+    }
+    cpu.RunFrame();
+    if (rewindEnabled && !console.CPUPaused) rewindBuffer.Push(console);
+    MeasureSpeed();
+    PushAudio();
+}
+
+static void RenderRunAhead(SDL_Renderer* renderer) {
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    runAheadState.resize(console.StateSize());
+    console.saveState(runAheadState.data());
+    apu.SetTimingOnly(true, cpu.TotalCycles);
+    for (int i = 0; i < runAheadFrames && !cpu.Halted; i++) cpu.RunFrame();
+    ppu.Render(renderer);
+    console.loadState(runAheadState.data()); // also puts the APU back the way it was
+
+    runAheadMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// battery RAM differs between the two sides, so the session gets blank RAM
+// of its own. the .sav is picked up again when the ROM is reloaded
+static bool StartNetplay() {
+    if (!netplay.Open(uint16_t(netLocalPort), netPeerHost, uint16_t(netPeerPort), netPlayer)) return false;
+    console.wram.fill(0);
+    console.prgRAM = console.wram.data();
+    console.CPUPaused = false;
+    rewindBuffer.Clear();
+    netplay.SetInputDelay(netDelay);
+    netplay.SetSimulatedLatency(netLatency);
+    netplay.SetSimulatedLoss(netLoss / 100);
+    netplay.Start(console);
+    return true;
+}
+
+// pad 1's keys drive whichever pad this side plays
+static void RunNetplayFrame() {
+    if (netplay.AdvanceFrame(console, console.controllers[0].state)) {
+        MeasureSpeed();
+        PushAudio();
+    }
+}
+
+// audio clocked pacing. sleeps until the callback has drained the ring below
+// its target, then emulates frames until it is topped up again. the video only
+// shows the last of those (the rest are dropped), and if the device stops
+// pulling samples the old frame is presented again (duplicated) so the UI
+// stays responsive.
+static void RunAudioSynced() {
+    const uint32_t timeoutMs = uint32_t(2000 / NES_FPS);
+    if (!audio.WaitForRoom(timeoutMs)) {
+        framesDuplicated++;
+        return;
+    }
+
+    // fast forward legitimately needs several frames per wakeup
+    const int maxFrames = int(AUDIO_SYNC_MAX_FRAMES * std::max(1.0, Speed()));
+    int frames = 0;
+    do {
+        EmulateFrame();
+        frames++;
+    } while (audio.NeedsSamples() && frames < maxFrames);
+    framesDropped += frames - 1;
+}
+
+// sleeps to the next 1/(60.0988 * speed) s deadline. deadlines accumulate, so SDL_Delay's
+// millisecond rounding evens out instead of adding up like a fixed delay does
+static void LimitFrameRate(double speed) {
+    static uint64_t next = 0;
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t period = uint64_t(freq / (NES_FPS * speed));
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (next == 0 || now > next + period * 4) next = now; // fell way behind, don't try to catch up
+    next += period;
+    if (next > now) SDL_Delay(Uint32((next - now) * 1000 / freq));
+}
 
 static const char* NesPalettes[] = { "NTSC", "PAL" };
 
 int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--nsf-render") {
+        return RunNSFRender(argc - 2, argv + 2);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--netplay-test") {
+        if (!globalROM.LoadNES(argv[2], console)) return 1;
+        return RunNetplayTest(console, argc - 3, argv + 3);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--hash-log") {
+        if (!globalROM.LoadNES(argv[2], console)) return 1;
+        return RunHashLog(console, argc - 3, argv + 3);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--hash-bisect") {
+        return RunHashBisect(argc - 2, argv + 2);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--movie-render") {
+        if (!globalROM.LoadNES(argv[2], console)) return 1;
+        return RunMovieRender(console, argc - 3, argv + 3);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--tas-search") {
+        if (!globalROM.LoadNES(argv[2], console)) return 1;
+        return RunTASSearch(console, argc - 3, argv + 3);
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
         std::cerr << "SDL init failed: " << SDL_GetError() << "\n";
         return 1;
@@ -38,6 +284,13 @@ int main(int argc, char* argv[]) {
     }
 
     if (!ppu.InitSDL(renderer)) return 1;
+    // without a device there's nobody to hear it, keep only what games can observe
+    if (audio.Open()) {
+        apu.SetSampleRate(audio.SampleRate());
+        stretch.SetSampleRate(audio.SampleRate());
+    } else {
+        apu.SetTimingOnly(true, 0);
+    }
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -45,15 +298,13 @@ int main(int argc, char* argv[]) {
     ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
     ImGui_ImplSDLRenderer2_Init(renderer);
 
-    std::array<uint8_t, MEMORY_SIZE> mem{};
     bool running = true;
-    std::string romPath;
     SDL_Event event;
 
     if (argc > 1) {
-        if (globalROM.LoadNES(argv[1], mem)) {
-            cpu.LoadMem(mem);
-            cpu.reset();
+        romPath = argv[1];
+        if (globalROM.LoadNES(romPath, console)) {
+            rewindBuffer.Clear();
             romIsLoaded = true;
         }
     }
@@ -62,7 +313,15 @@ int main(int argc, char* argv[]) {
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
             if (event.type == SDL_QUIT) running = false;
+            if (event.type == SDL_KEYDOWN && !event.key.repeat && !ImGui::GetIO().WantCaptureKeyboard) {
+                if (event.key.keysym.scancode == SDL_SCANCODE_F5 && romIsLoaded) SaveStateSlot(stateSlot);
+                if (event.key.keysym.scancode == SDL_SCANCODE_F9 && CanLoadState()) LoadStateSlot(stateSlot);
+            }
         }
+        const uint8_t* keys = SDL_GetKeyboardState(nullptr);
+        bool keyboardFree = !ImGui::GetIO().WantCaptureKeyboard;
+        turbo = keys[SDL_SCANCODE_TAB] && keyboardFree;
+        rewinding = keys[SDL_SCANCODE_BACKSPACE] && keyboardFree && rewindEnabled && !netplay.IsOpen() && !MovieOpen();
         ImGui_ImplSDLRenderer2_NewFrame();
         ImGui_ImplSDL2_NewFrame();
         ImGui::NewFrame();
@@ -74,15 +333,17 @@ int main(int argc, char* argv[]) {
                     auto selection = pfd::open_file(
                         "Select NES ROM",
                         "",
-                        { "NES ROMs", "*.nes" },
+                        { "NES ROMs", "*.nes *.zip *.gz" },
                         pfd::opt::none
                     ).result();
 
                     if (!selection.empty()) {
                         romPath = selection.front();
-                        if (globalROM.LoadNES(romPath, mem)) {
-                            cpu.LoadMem(mem);
-                            cpu.reset();
+                        movieWriter.Close();
+                        moviePlayer.Close();
+                        if (globalROM.LoadNES(romPath, console)) {
+                            netplay.Close();
+                            rewindBuffer.Clear();
                             romIsLoaded = true;
                         } else {
                             std::cerr << "Failed to load ROM: " << romPath << "\n";
@@ -90,10 +351,31 @@ int main(int argc, char* argv[]) {
                     }
                 }
 
+                if (ImGui::BeginMenu("Save state", romIsLoaded)) {
+                    for (int i = 1; i <= SAVESTATE_SLOTS; i++) {
+                        std::string label = "Slot " + std::to_string(i);
+                        if (ImGui::MenuItem(label.c_str(), i == stateSlot ? "F5" : nullptr)) SaveStateSlot(i);
+                    }
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Load state", CanLoadState())) {
+                    for (int i = 1; i <= SAVESTATE_SLOTS; i++) {
+                        std::string label = "Slot " + std::to_string(i);
+                        bool saved = std::filesystem::exists(StatePathForROM(romPath, i));
+                        if (ImGui::MenuItem(label.c_str(), i == stateSlot ? "F9" : nullptr, false, saved)) LoadStateSlot(i);
+                    }
+                    ImGui::EndMenu();
+                }
+
                 if (romIsLoaded) {
                     if (ImGui::MenuItem("Close ROM")) {
                         romIsLoaded = false;
-                        cpu.reset();
+                        sram.Close();
+                        console.LoadCartridge(nullptr, false, nullptr);
+                        netplay.Close();
+                        movieWriter.Close();
+                        moviePlayer.Close();
+                        rewindBuffer.Clear();
                     }
                 }
 
@@ -101,14 +383,26 @@ int main(int argc, char* argv[]) {
             }
 
             if (ImGui::BeginMenu("CPU")) {
-                if (ImGui::MenuItem("Pause")) {
-                    cpu.CPUPaused = true;
+                if (ImGui::MenuItem("Pause", nullptr, false, !netplay.IsOpen())) {
+                    console.CPUPaused = true;
                 }
                 if (ImGui::MenuItem("Continue")) {
-                    cpu.CPUPaused = false;
+                    console.CPUPaused = false;
                 }
-                if (ImGui::MenuItem("Reset")) {
-                    cpu.reset();
+                if (ImGui::MenuItem("Reset", nullptr, false, !netplay.IsOpen() && !MovieOpen())) {
+                    console.Reset();
+                }
+                ImGui::Separator();
+                ImGui::Text("State hash %016llx", (unsigned long long)stateHash);
+                bool logging = hashLog.is_open();
+                if (ImGui::MenuItem("Log state hashes", nullptr, &logging)) {
+                    if (logging) {
+                        hashLog.open("hashes.log");
+                        hashLog << "# MeowNES hash log v1\n";
+                        hashFrame = 0;
+                    } else {
+                        hashLog.close();
+                    }
                 }
 
                 ImGui::EndMenu();
@@ -132,11 +426,110 @@ int main(int argc, char* argv[]) {
                         else SDL_SetWindowFullscreen(window, 0);
                     }
                     ImGui::Checkbox("Unlimited FPS", &unlimitFPS);
+                    ImGui::Checkbox("Draw picture", &drawPicture);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Speed")) {
+                    ImGui::SetNextItemWidth(70);
+                    ImGui::Combo("Speed", &speedIndex, SpeedNames, IM_ARRAYSIZE(SpeedNames));
+                    ImGui::Text("running at %.2fx, hold Tab for turbo", measuredSpeed);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Run-ahead")) {
+                    ImGui::SetNextItemWidth(70);
+                    ImGui::SliderInt("Frames", &runAheadFrames, 0, RUNAHEAD_MAX_FRAMES);
+                    if (runAheadFrames > 0) ImGui::Text("%.2f ms per frame", runAheadMs);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Rewind")) {
+                    if (ImGui::Checkbox("Enabled", &rewindEnabled) && !rewindEnabled) {
+                        rewindBuffer.Clear();
+                    }
+                    ImGui::Text("%.0f s in %.1f of %.0f MB, hold Backspace",
+                                rewindBuffer.Frames() / NES_FPS, rewindBuffer.BytesUsed() / 1048576.0,
+                                rewindBuffer.Budget() / 1048576.0);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Audio")) {
+                    ImGui::Checkbox("Sound", &soundEnabled);
+                    if (audio.IsOpen()) {
+                        ImGui::Text("%d Hz, %.1f ms latency", audio.SampleRate(), audio.LatencyMs());
+                        ImGui::Text("rate %.4f, %u underruns", audio.RateRatio(), audio.Underruns());
+                        ImGui::SetNextItemWidth(70);
+                        ImGui::Combo("Sync", &syncMode, SyncModes, IM_ARRAYSIZE(SyncModes));
+                        if (syncMode == SYNC_AUDIO) {
+                            ImGui::Text("%u frames duplicated, %u dropped", framesDuplicated, framesDropped);
+                        }
+                    }
                     ImGui::EndMenu();
                 }
                 ImGui::EndMenu();
             }
 
+            if (ImGui::BeginMenu("Movie")) {
+                bool busy = MovieOpen() || netplay.IsOpen();
+                if (ImGui::MenuItem("Record...", nullptr, false, romIsLoaded && !busy)) {
+                    auto path = pfd::save_file("Record movie", "", { "MeowNES movies", "*.mnm" }).result();
+                    if (!path.empty()) movieWriter.Open(path, console);
+                }
+                if (ImGui::MenuItem("Play...", nullptr, false, romIsLoaded && !busy)) {
+                    auto selection = pfd::open_file("Play movie", "", { "MeowNES movies", "*.mnm" }, pfd::opt::none).result();
+                    if (!selection.empty() && moviePlayer.Open(selection.front(), console)) {
+                        moviePlayer.Seek(console, 0);
+                        console.CPUPaused = false;
+                    }
+                }
+                if (ImGui::MenuItem("Stop", nullptr, false, MovieOpen())) {
+                    movieWriter.Close();
+                    moviePlayer.Close();
+                }
+
+                if (movieWriter.IsOpen()) ImGui::Text("recording, frame %u", movieWriter.Frames());
+                if (moviePlayer.IsOpen()) {
+                    movieSeekFrame = int(moviePlayer.Frame());
+                    ImGui::SetNextItemWidth(200);
+                    if (ImGui::SliderInt("Frame", &movieSeekFrame, 0, int(moviePlayer.Frames()))) {
+                        moviePlayer.Seek(console, uint32_t(movieSeekFrame));
+                    }
+                }
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::BeginMenu("Netplay")) {
+                bool open = netplay.IsOpen();
+                ImGui::BeginDisabled(open);
+                ImGui::SetNextItemWidth(120);
+                ImGui::InputText("Peer host", netPeerHost, sizeof(netPeerHost));
+                ImGui::SetNextItemWidth(120);
+                ImGui::InputInt("Peer port", &netPeerPort);
+                ImGui::SetNextItemWidth(120);
+                ImGui::InputInt("Local port", &netLocalPort);
+                ImGui::SetNextItemWidth(70);
+                ImGui::Combo("Player", &netPlayer, NetPlayers, IM_ARRAYSIZE(NetPlayers));
+                ImGui::SetNextItemWidth(120);
+                ImGui::SliderInt("Input delay", &netDelay, 0, NETPLAY_MAX_DELAY);
+                ImGui::EndDisabled();
+
+                // for trying it out on one machine
+                ImGui::SetNextItemWidth(120);
+                if (ImGui::SliderInt("Added latency (ms)", &netLatency, 0, 300)) netplay.SetSimulatedLatency(netLatency);
+                ImGui::SetNextItemWidth(120);
+                if (ImGui::SliderFloat("Packet loss (%)", &netLoss, 0, 50, "%.0f")) netplay.SetSimulatedLoss(netLoss / 100);
+
+                if (!open) {
+                    if (ImGui::MenuItem("Start", nullptr, false, romIsLoaded && !MovieOpen())) StartNetplay();
+                } else {
+                    const NetplayStats& st = netplay.Stats();
+                    if (ImGui::MenuItem("Stop")) netplay.Close();
+                    if (netplay.PeerSeen()) ImGui::Text("frame %u, peer confirmed to %u", netplay.Frame(), netplay.ConfirmedFrames());
+                    else ImGui::Text("frame %u, waiting for the peer", netplay.Frame());
+                    ImGui::Text("%u rollbacks, longest %u frames, last took %.2f ms", st.rollbacks, st.maxRollback, st.resimMs);
+                    ImGui::Text("%u stalls, %u state hashes matched", st.stalls, st.hashesChecked);
+                    if (st.desyncFrame >= 0) ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "desync at frame %lld", (long long)st.desyncFrame);
+                }
+                ImGui::EndMenu();
+            }
+
             if (ImGui::BeginMenu("Misc")) {
                 if (ImGui::MenuItem("Exit")) {
                     running = false;
@@ -150,18 +543,56 @@ int main(int argc, char* argv[]) {
         SDL_SetRenderDrawColor(renderer, 0x20, 0x20, 0x20, 0xff);
         SDL_RenderClear(renderer);
 
+        // audio sync needs a device that is actually being fed, otherwise fall back to the timer
+        bool audioSynced = syncMode == SYNC_AUDIO && audio.IsOpen() && romIsLoaded
+            && !console.CPUPaused && !Unlimited() && !rewinding && !netplay.IsOpen();
+
         if (romIsLoaded) {
             UpdateControllers();
-            ppu.Render(renderer);
-            cpu.run(89342);
+            if (netplay.IsOpen()) {
+                RunNetplayFrame();
+            } else if (rewinding) {
+                if (!console.CPUPaused) rewindBuffer.StepBack(console);
+            } else if (audioSynced) {
+                RunAudioSynced();
+            } else {
+                EmulateFrame();
+            }
+
+            // drawn after emulating, so the frame shown already saw this frame's input
+            if (!drawPicture) {
+                SDL_RenderClear(renderer);
+            } else if (runAheadFrames > 0 && !rewinding && !netplay.IsOpen() && !console.CPUPaused && !cpu.Halted) {
+                RenderRunAhead(renderer);
+            } else {
+                ppu.Render(renderer);
+            }
+
+            stateHash = console.Hash();
+            if (hashLog.is_open()) {
+                char line[48];
+                snprintf(line, sizeof(line), "f %llu %016llx\n", (unsigned long long)hashFrame++, (unsigned long long)stateHash);
+                hashLog << line;
+            }
+
+            if (console.PrgRAMDirty) {
+                sram.Dirty = true;
+                console.PrgRAMDirty = false;
+            }
+            sram.Flush();
+
+            if (cpu.Halted) {
+                romIsLoaded = false;
+                SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Fatal error", "Unimplemented opcode, see the log", window);
+            }
         }
 
         ImGui::Render();
         ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), renderer);
         SDL_RenderPresent(renderer);
 
-        if (!unlimitFPS) {
-            SDL_Delay(16);
+        if (!Unlimited() && !audioSynced) {
+            LimitFrameRate(Speed());
         }
     }
 
@@ -169,6 +600,8 @@ int main(int argc, char* argv[]) {
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 
+    sram.Close();
+    audio.Close();
     ppu.ShutdownSDL();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -0,0 +1,186 @@
+#include "meownes_env.h"
+#include "nes_console.hpp"
+#include "nes_cart.hpp"
+#include "nes_obs.hpp"
+#include "worker_pool.hpp"
+#include "nes.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+struct EnvInstance {
+    std::unique_ptr<Console> nes;
+    uint64_t rng = 0;
+    uint8_t lastAction = 0;  // what the pad actually held last frame, sticky actions repeat it
+    uint32_t episodeFrames = 0;
+    bool done = false;
+
+    // max pooling: the observation of frame lastObsFrame, and room for the next
+    std::vector<uint8_t> lastObs, nextObs;
+    uint32_t lastObsFrame = UINT32_MAX;
+};
+
+struct meownes_vec_env {
+    meownes_env_config config;
+    std::vector<EnvInstance> envs;
+    std::unique_ptr<WorkerPool> pool;
+    ObsScaler scaler;
+    int obsSlot = 0;  // ring slot written last
+};
+
+// splitmix64, a float in [0, 1)
+static float NextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return float(z >> 40) * (1.0f / float(1u << 24));
+}
+
+static void NewEpisode(EnvInstance& e) {
+    e.nes->wram.fill(0); // every episode starts from the same blank $6000-$7FFF
+    e.nes->PowerOn();
+    e.lastAction = 0;
+    e.episodeFrames = 0;
+    e.done = false;
+    e.lastObsFrame = UINT32_MAX;
+}
+
+// fresh: the episode began in this call, so the ring holds nothing of it yet
+static void WriteOutputs(meownes_vec_env* v, EnvInstance& e, size_t i, uint8_t* ram, uint8_t* obs,
+                         uint8_t* done, bool fresh) {
+    if (ram) std::memcpy(ram + i * MEOWNES_RAM_SIZE, e.nes->cpu.RAM.data(), MEOWNES_RAM_SIZE);
+    if (done) done[i] = e.done;
+    if (!obs) return;
+
+    const size_t size = v->scaler.Size();
+    const size_t stack = size_t(v->config.obs_stack);
+    uint8_t* ring = obs + i * stack * size;
+    uint8_t* slot = ring + size_t(v->obsSlot) * size;
+    if (v->config.obs_max_pool) {
+        v->scaler.Render(e.nes->ppu, e.nextObs.data());
+        if (e.lastObsFrame + 1 == e.episodeFrames) MaxPool(e.nextObs.data(), e.lastObs.data(), slot, size);
+        else std::memcpy(slot, e.nextObs.data(), size);
+        std::swap(e.lastObs, e.nextObs);
+        e.lastObsFrame = e.episodeFrames;
+    } else {
+        v->scaler.Render(e.nes->ppu, slot);
+    }
+    if (fresh) {
+        for (size_t k = 0; k < stack; k++) {
+            if (ring + k * size != slot) std::memcpy(ring + k * size, slot, size);
+        }
+    }
+}
+
+extern "C" {
+
+void meownes_env_default_config(meownes_env_config* config) {
+    config->num_envs = 1;
+    config->num_threads = 0;
+    config->sticky_action_prob = 0;
+    config->max_episode_frames = 0;
+    config->seed = 0;
+    config->obs_width = MEOWNES_FRAME_WIDTH;
+    config->obs_height = MEOWNES_FRAME_HEIGHT;
+    config->obs_format = MEOWNES_OBS_INDEX;
+    config->obs_max_pool = 0;
+    config->obs_stack = 1;
+}
+
+meownes_vec_env* meownes_vec_create(const char* rom_path, const meownes_env_config* config) {
+    Cartridge cart;
+    if (!config || config->num_envs < 1 || !LoadCartridgeFile(rom_path, cart)) return nullptr;
+    if (config->obs_stack < 1) {
+        std::cerr << "obs_stack must be at least 1" << std::endl;
+        return nullptr;
+    }
+    if (config->obs_max_pool && config->obs_format != MEOWNES_OBS_GREY) {
+        // the larger of two palette indices is just another colour
+        std::cerr << "obs_max_pool needs obs_format MEOWNES_OBS_GREY" << std::endl;
+        return nullptr;
+    }
+
+    auto v = std::make_unique<meownes_vec_env>();
+    v->config = *config;
+    v->scaler.Setup(config->obs_width, config->obs_height,
+                    config->obs_format == MEOWNES_OBS_GREY ? ObsFormat::Grey : ObsFormat::Index);
+    v->envs.resize(size_t(config->num_envs));
+    for (size_t i = 0; i < v->envs.size(); i++) {
+        EnvInstance& e = v->envs[i];
+        e.nes = std::make_unique<Console>();
+        e.nes->apu.SetTimingOnly(true, 0);
+        e.nes->LoadCartridge(cart.rom, cart.verticalMirror, nullptr);
+        e.rng = config->seed + i * 0x9E3779B97F4A7C15ull;
+        if (config->obs_max_pool) {
+            e.lastObs.resize(v->scaler.Size());
+            e.nextObs.resize(v->scaler.Size());
+        }
+        NewEpisode(e);
+    }
+    v->pool = std::make_unique<WorkerPool>(unsigned(std::max(0, config->num_threads)));
+    return v.release();
+}
+
+void meownes_vec_destroy(meownes_vec_env* env) {
+    delete env;
+}
+
+int meownes_vec_num_envs(const meownes_vec_env* env) {
+    return int(env->envs.size());
+}
+
+size_t meownes_vec_obs_size(const meownes_vec_env* env) {
+    return env->scaler.Size();
+}
+
+int meownes_vec_obs_slot(const meownes_vec_env* env) {
+    return env->obsSlot;
+}
+
+void meownes_vec_reset(meownes_vec_env* env, uint8_t* ram, uint8_t* obs) {
+    env->obsSlot = 0;
+    env->pool->Run(env->envs.size(), [&](size_t i) {
+        NewEpisode(env->envs[i]);
+        WriteOutputs(env, env->envs[i], i, ram, obs, nullptr, true);
+    });
+}
+
+void meownes_vec_step(meownes_vec_env* env, const uint8_t* actions, int frames_per_action,
+                      uint8_t* ram, uint8_t* obs, uint8_t* done) {
+    const float sticky = env->config.sticky_action_prob;
+    const uint32_t maxFrames = uint32_t(std::max(0, env->config.max_episode_frames));
+    const bool pool = obs && env->config.obs_max_pool;
+    if (obs) env->obsSlot = (env->obsSlot + 1) % env->config.obs_stack;
+
+    env->pool->Run(env->envs.size(), [&](size_t i) {
+        EnvInstance& e = env->envs[i];
+        Console& nes = *e.nes;
+        const bool fresh = e.done;
+        if (e.done) NewEpisode(e);
+
+        for (int f = 0; f < frames_per_action; f++) {
+            uint8_t action = actions[i];
+            if (sticky > 0 && NextRandom(e.rng) < sticky) action = e.lastAction;
+            e.lastAction = action;
+            nes.controllers[0].state = action;
+
+            nes.cpu.RunFrame();
+            e.episodeFrames++;
+            if (nes.cpu.Halted || (maxFrames && e.episodeFrames >= maxFrames)) {
+                e.done = true;
+                break;
+            }
+            // the frame before the last, to pool against
+            if (pool && f == frames_per_action - 2) {
+                env->scaler.Render(nes.ppu, e.lastObs.data());
+                e.lastObsFrame = e.episodeFrames;
+            }
+        }
+        WriteOutputs(env, e, i, ram, obs, done, fresh);
+    });
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef MEOWNES_ENV_H
+#define MEOWNES_ENV_H
+
+/* a plain C interface to many consoles running one ROM at once, for
+ * training agents. every call works on all of them together: the work is
+ * spread over a pool of threads, and results go into buffers the caller
+ * owns, one slot per console back to back. nothing is allocated per step.
+ * the consoles make no sound and only draw when asked to.
+ *
+ * build with `make lib`, link build/libmeownes.a with -lstdc++ -lpthread -lSDL2 */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEOWNES_RAM_SIZE 2048
+#define MEOWNES_FRAME_WIDTH 256
+#define MEOWNES_FRAME_HEIGHT 240
+
+/* meownes_env_config.obs_format */
+#define MEOWNES_OBS_INDEX 0 /* NES colour index (0-63), nearest pixel */
+#define MEOWNES_OBS_GREY 1  /* luma, averaged over the area each pixel covers */
+
+typedef struct meownes_vec_env meownes_vec_env;
+
+typedef struct meownes_env_config {
+    int num_envs;
+    int num_threads;          /* 0: one per core */
+    float sticky_action_prob; /* every frame, the chance the previous action repeats instead */
+    int max_episode_frames;   /* an episode is done after this many frames, 0: no limit */
+    uint64_t seed;            /* for sticky actions, the same seed gives the same run */
+
+    /* the picture handed back, scaled down while it is drawn. the default is
+     * the whole frame as colour indices; agents usually want 84x84 grey */
+    int obs_width;            /* 1-256 */
+    int obs_height;           /* 1-240 */
+    int obs_format;           /* MEOWNES_OBS_INDEX or MEOWNES_OBS_GREY */
+    int obs_max_pool;         /* nonzero: each pixel is the max of the last two frames, against sprite
+                               * flicker. MEOWNES_OBS_GREY only, the create call fails otherwise */
+    int obs_stack;            /* observations kept per console, see meownes_vec_obs_slot */
+} meownes_env_config;
+
+void meownes_env_default_config(meownes_env_config* config);
+
+/* NULL if the ROM can't be loaded, the reason goes to stderr */
+meownes_vec_env* meownes_vec_create(const char* rom_path, const meownes_env_config* config);
+void meownes_vec_destroy(meownes_vec_env* env);
+int meownes_vec_num_envs(const meownes_vec_env* env);
+
+/* bytes in one observation, obs_width * obs_height after clamping */
+size_t meownes_vec_obs_size(const meownes_vec_env* env);
+
+/* obs is a ring of obs_stack observations per console: console i's slot k
+ * starts at obs + (i * obs_stack + k) * meownes_vec_obs_size(env). each
+ * step writes the next slot for every console, this is the one written
+ * last and (slot + 1) % obs_stack is the oldest. pass the same buffer on
+ * every call */
+int meownes_vec_obs_slot(const meownes_vec_env* env);
+
+/* powers every console on for a new episode. outputs as for step, the first
+ * observation fills every slot of the ring */
+void meownes_vec_reset(meownes_vec_env* env, uint8_t* ram, uint8_t* obs);
+
+/* actions[i] is pad 1 of console i (A_BUTTON and friends from nes.hpp) and
+ * is held for frames_per_action frames. out, each may be NULL:
+ *   ram:    num_envs * MEOWNES_RAM_SIZE, the work RAM after the last frame
+ *   obs:    num_envs * obs_stack * meownes_vec_obs_size(env), the ring above.
+ *           the last frame goes into the next slot. NULL skips drawing
+ *           altogether. a console that starts a new episode fills its ring
+ *   done:   num_envs, 1 when the episode ended during this step (time limit
+ *           or the CPU stopped). that console starts a new one on the next step */
+void meownes_vec_step(meownes_vec_env* env, const uint8_t* actions, int frames_per_action,
+                      uint8_t* ram, uint8_t* obs, uint8_t* done);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,617 @@
+#include "nes_apu.hpp"
+#include "nes_console.hpp"
+
+#include <algorithm>
+
+#define MIX_SCALE 32000
+
+static const uint8_t lengthTable[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t dutyTable[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const uint16_t noiseTable[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t dmcTable[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// frame sequencer step times in cpu cycles, the last one is a half frame too
+static const uint32_t frameSteps4[4] = { 7457, 14913, 22371, 29829 };
+static const uint32_t frameSteps5[4] = { 7457, 14913, 22371, 37281 };
+#define FRAME_PERIOD_4 29830
+#define FRAME_PERIOD_5 37282
+
+// the 2A03 mixes nonlinearly, both halves of the mixer are table lookups
+struct MixTables {
+    int pulse[31];
+    int tnd[203];
+
+    MixTables() {
+        pulse[0] = tnd[0] = 0;
+        for (int i = 1; i < 31; i++) pulse[i] = int(95.52 / (8128.0 / i + 100) * MIX_SCALE);
+        for (int i = 1; i < 203; i++) tnd[i] = int(163.67 / (24329.0 / i + 100) * MIX_SCALE);
+    }
+};
+
+static const MixTables mixTables;
+
+// steps from each position until the duty output flips
+struct DutyDistance {
+    uint8_t steps[4][8];
+
+    DutyDistance() {
+        for (int d = 0; d < 4; d++) {
+            for (int p = 0; p < 8; p++) {
+                int k = 1;
+                while (dutyTable[d][(p + k) & 7] == dutyTable[d][p]) k++;
+                steps[d][p] = uint8_t(k);
+            }
+        }
+    }
+};
+
+static const DutyDistance dutyDistance;
+
+void Envelope::Write(uint8_t value) {
+    loop = (value & 0x20) != 0;
+    constant = (value & 0x10) != 0;
+    period = value & 0x0F;
+}
+
+void Envelope::Clock() {
+    if (start) {
+        start = false;
+        decay = 15;
+        divider = period;
+    } else if (divider == 0) {
+        divider = period;
+        if (decay > 0) decay--;
+        else if (loop) decay = 15;
+    } else {
+        divider--;
+    }
+}
+
+// pulse
+
+void PulseChannel::Write(int reg, uint8_t value) {
+    switch (reg) {
+        case 0:
+            duty = value >> 6;
+            env.Write(value);
+            break;
+        case 1:
+            sweepEnabled = (value & 0x80) != 0;
+            sweepPeriod = (value >> 4) & 7;
+            sweepNegate = (value & 0x08) != 0;
+            sweepShift = value & 7;
+            sweepReload = true;
+            break;
+        case 2:
+            period = (period & 0x700) | value;
+            break;
+        case 3:
+            period = (period & 0xFF) | ((value & 7) << 8);
+            if (enabled) length = lengthTable[value >> 3];
+            pos = 0;
+            env.start = true;
+            break;
+    }
+}
+
+// the timer keeps running while muted, so the phase is just recomputed
+void PulseChannel::Advance(uint64_t t) {
+    if (t < stepTime) return;
+    uint64_t len = 2 * (uint64_t(period) + 1);
+    uint64_t n = (t - stepTime) / len + 1;
+    pos = uint8_t((pos + n) & 7);
+    stepTime += n * len;
+}
+
+uint16_t PulseChannel::SweepTarget() const {
+    int change = period >> sweepShift;
+    int target = sweepNegate ? period - change - (onesComplement ? 1 : 0) : period + change;
+    return uint16_t(std::max(target, 0));
+}
+
+void PulseChannel::ClockSweep() {
+    uint16_t target = SweepTarget();
+    if (sweepDivider == 0 && sweepEnabled && sweepShift > 0 && period >= 8 && target <= 0x7FF) {
+        period = target;
+    }
+    if (sweepDivider == 0 || sweepReload) {
+        sweepDivider = sweepPeriod;
+        sweepReload = false;
+    } else {
+        sweepDivider--;
+    }
+}
+
+uint8_t PulseChannel::Output() const {
+    if (Muted() || !dutyTable[duty][pos]) return 0;
+    return env.Volume();
+}
+
+uint64_t PulseChannel::NextChange() const {
+    if (Muted() || env.Volume() == 0) return APU_NEVER;
+    uint64_t len = 2 * (uint64_t(period) + 1);
+    return stepTime + (dutyDistance.steps[duty][pos] - 1) * len;
+}
+
+// triangle
+
+void TriangleChannel::Write(int reg, uint8_t value) {
+    switch (reg) {
+        case 0:
+            control = (value & 0x80) != 0;
+            linearPeriod = value & 0x7F;
+            break;
+        case 2:
+            period = (period & 0x700) | value;
+            break;
+        case 3:
+            period = (period & 0xFF) | ((value & 7) << 8);
+            if (enabled) length = lengthTable[value >> 3];
+            linearReload = true;
+            break;
+    }
+}
+
+void TriangleChannel::Advance(uint64_t t) {
+    if (t < stepTime) return;
+    uint64_t len = uint64_t(period) + 1;
+    uint64_t n = (t - stepTime) / len + 1;
+    if (Running()) pos = uint8_t((pos + n) & 31);
+    stepTime += n * len;
+}
+
+void TriangleChannel::ClockLinear() {
+    if (linearReload) linear = linearPeriod;
+    else if (linear > 0) linear--;
+    if (!control) linearReload = false;
+}
+
+uint8_t TriangleChannel::Output() const {
+    return pos < 16 ? 15 - pos : pos - 16;
+}
+
+uint64_t TriangleChannel::NextChange() const {
+    // ultrasonic periods are left frozen, like most emulators do
+    if (!Running()) return APU_NEVER;
+    // 15 -> 16 and 31 -> 0 repeat the same level
+    if ((pos & 15) == 15) return stepTime + period + 1;
+    return stepTime;
+}
+
+// noise
+
+void NoiseChannel::Write(int reg, uint8_t value) {
+    switch (reg) {
+        case 0:
+            env.Write(value);
+            break;
+        case 2:
+            mode = (value & 0x80) != 0;
+            period = noiseTable[value & 0x0F];
+            break;
+        case 3:
+            if (enabled) length = lengthTable[value >> 3];
+            env.start = true;
+            break;
+    }
+}
+
+// the LFSR is linear over GF(2), so n clocks are one matrix power. for each
+// mode, jump[k][j] is where bit j of the register ends up after 2^k clocks
+struct LFSRJumps {
+    uint16_t jump[2][64][15];
+};
+
+static uint16_t ApplyJump(const uint16_t* columns, uint16_t lfsr) {
+    uint16_t out = 0;
+    for (int j = 0; j < 15; j++) {
+        if (lfsr >> j & 1) out ^= columns[j];
+    }
+    return out;
+}
+
+static const LFSRJumps& Jumps() {
+    static const LFSRJumps table = [] {
+        LFSRJumps t;
+        for (int mode = 0; mode < 2; mode++) {
+            int tap = mode ? 6 : 1;
+            for (int j = 0; j < 15; j++) {
+                uint16_t s = uint16_t(1 << j);
+                t.jump[mode][0][j] = uint16_t((s >> 1) | (((s ^ (s >> tap)) & 1) << 14));
+            }
+            for (int k = 1; k < 64; k++) {
+                for (int j = 0; j < 15; j++) {
+                    t.jump[mode][k][j] = ApplyJump(t.jump[mode][k - 1], t.jump[mode][k - 1][j]);
+                }
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+void NoiseChannel::Advance(uint64_t t) {
+    if (t < stepTime) return;
+    // a muted channel is only caught up when something looks, so this can
+    // be thousands of clocks: jump by powers of two instead of clocking each
+    uint64_t n = (t - stepTime) / period + 1;
+    stepTime += n * period;
+    const auto& jump = Jumps().jump[mode ? 1 : 0];
+    for (int k = 0; n; k++, n >>= 1) {
+        if (n & 1) lfsr = ApplyJump(jump[k], lfsr);
+    }
+}
+
+uint8_t NoiseChannel::Output() const {
+    if (length == 0 || (lfsr & 1)) return 0;
+    return env.Volume();
+}
+
+uint64_t NoiseChannel::NextChange() const {
+    if (length == 0 || env.Volume() == 0) return APU_NEVER;
+    return stepTime;
+}
+
+// dmc
+
+void DMCChannel::Write(int reg, uint8_t value) {
+    switch (reg) {
+        case 0:
+            irqEnabled = (value & 0x80) != 0;
+            if (!irqEnabled) irq = false;
+            loop = (value & 0x40) != 0;
+            period = dmcTable[value & 0x0F];
+            break;
+        case 1:
+            level = value & 0x7F;
+            break;
+        case 2:
+            sampleAddr = 0xC000 | (value << 6);
+            break;
+        case 3:
+            sampleLength = (value << 4) | 1;
+            break;
+    }
+}
+
+void DMCChannel::Restart() {
+    addr = sampleAddr;
+    bytesRemaining = sampleLength;
+}
+
+void DMCChannel::Fetch(CPU& bus) {
+    if (!bufferEmpty || bytesRemaining == 0) return;
+
+    buffer = bus.read(addr); // always $8000-$FFFF, no side effects
+    bufferEmpty = false;
+    stall += 4;
+    addr = addr == 0xFFFF ? 0x8000 : addr + 1;
+
+    if (--bytesRemaining == 0) {
+        if (loop) Restart();
+        else if (irqEnabled) irq = true;
+    }
+}
+
+void DMCChannel::Advance(uint64_t t, CPU& bus) {
+    while (stepTime <= t) {
+        if (Idle()) {
+            // nothing can change until the next $4015 write, only keep the phase
+            uint64_t n = (t - stepTime) / period + 1;
+            bitsRemaining = uint8_t((bitsRemaining + 7 - n % 8) % 8 + 1);
+            stepTime += n * period;
+            return;
+        }
+
+        if (!silence) {
+            if (shift & 1) {
+                if (level <= 125) level += 2;
+            } else {
+                if (level >= 2) level -= 2;
+            }
+        }
+        shift >>= 1;
+
+        if (--bitsRemaining == 0) {
+            bitsRemaining = 8;
+            if (bufferEmpty) {
+                silence = true;
+            } else {
+                silence = false;
+                shift = buffer;
+                bufferEmpty = true;
+                Fetch(bus);
+            }
+        }
+        stepTime += period;
+    }
+}
+
+uint64_t DMCChannel::NextFetch() const {
+    if (bytesRemaining == 0) return APU_NEVER;
+    return stepTime + uint64_t(bitsRemaining - 1) * period;
+}
+
+// apu
+
+Console& APU::Nes() {
+    return Console::Of(this);
+}
+
+void APU::SetSampleRate(double rate) {
+    Nes().resampler.SetRates(APU_NATIVE_RATE, rate);
+}
+
+void APU::AdjustSampleRate(double rate) {
+    Nes().resampler.AdjustOutputRate(rate);
+}
+
+void APU::reset(uint64_t now) {
+    pulse1 = PulseChannel();
+    pulse2 = PulseChannel();
+    pulse1.onesComplement = true;
+    triangle = TriangleChannel();
+    noise = NoiseChannel();
+    dmc = DMCChannel();
+
+    pulse1.stepTime = pulse2.stepTime = triangle.stepTime = now;
+    noise.stepTime = dmc.stepTime = now;
+
+    frameIRQ = false;
+    ResetFrameSequencer(now, 0);
+
+    time = frameBase = now;
+    level = 0;
+    Nes().blip.Clear();
+    Nes().resampler.Clear();
+    UpdateNextEvent();
+}
+
+size_t APU::ReadSamples(int16_t* out, size_t max) {
+    BlipBuffer& blip = Nes().blip;
+    AudioResampler& resampler = Nes().resampler;
+    int16_t native[512];
+    size_t n = resampler.Read(out, max);
+    while (n < max && blip.SamplesAvail() > 0) {
+        size_t got = blip.ReadSamples(native, std::min(sizeof(native) / sizeof(native[0]), resampler.Room()));
+        resampler.Write(native, got);
+        n += resampler.Read(out + n, max - n);
+    }
+    return n;
+}
+
+void APU::AdvanceChannels(uint64_t t) {
+    pulse1.Advance(t);
+    pulse2.Advance(t);
+    triangle.Advance(t);
+    noise.Advance(t);
+    dmc.Advance(t, Nes().cpu);
+}
+
+void APU::ClockQuarterFrame() {
+    pulse1.env.Clock();
+    pulse2.env.Clock();
+    noise.env.Clock();
+    triangle.ClockLinear();
+}
+
+void APU::ClockHalfFrame() {
+    if (!pulse1.env.loop && pulse1.length) pulse1.length--;
+    if (!pulse2.env.loop && pulse2.length) pulse2.length--;
+    if (!triangle.control && triangle.length) triangle.length--;
+    if (!noise.env.loop && noise.length) noise.length--;
+    pulse1.ClockSweep();
+    pulse2.ClockSweep();
+}
+
+void APU::ResetFrameSequencer(uint64_t t, uint8_t value) {
+    fiveStep = (value & 0x80) != 0;
+    irqInhibit = (value & 0x40) != 0;
+    if (irqInhibit) frameIRQ = false;
+
+    frameStep = 0;
+    frameNext = t + frameSteps4[0];
+
+    // writing with bit 7 set clocks everything right away
+    if (fiveStep) {
+        ClockQuarterFrame();
+        ClockHalfFrame();
+    }
+}
+
+void APU::ClockFrameSequencer() {
+    const uint32_t* steps = fiveStep ? frameSteps5 : frameSteps4;
+
+    ClockQuarterFrame();
+    if (frameStep == 1 || frameStep == 3) ClockHalfFrame();
+    if (frameStep == 3 && !fiveStep && !irqInhibit) frameIRQ = true;
+
+    uint64_t start = frameNext - steps[frameStep];
+    if (++frameStep == 4) {
+        frameStep = 0;
+        start += fiveStep ? FRAME_PERIOD_5 : FRAME_PERIOD_4;
+    }
+    frameNext = start + steps[frameStep];
+}
+
+void APU::UpdateLevel(uint64_t t) {
+    if (timingOnly) return;
+    int p = pulse1.Output() + pulse2.Output();
+    int tnd = 3 * triangle.Output() + 2 * noise.Output() + dmc.level;
+    int mixed = mixTables.pulse[p] + mixTables.tnd[tnd];
+    if (mixed != level) {
+        Nes().blip.AddDelta(uint32_t(t - frameBase), mixed - level);
+        level = mixed;
+    }
+}
+
+void APU::UpdateNextEvent() {
+    nextEvent = dmc.NextFetch();
+    if (!fiveStep && !irqInhibit && !frameIRQ) {
+        uint64_t irqTime = frameNext + (frameSteps4[3] - frameSteps4[frameStep]);
+        nextEvent = std::min(nextEvent, irqTime);
+    }
+}
+
+void APU::SetTimingOnly(bool on, uint64_t now) {
+    RunUntil(now);
+    if (timingOnly && !on) {
+        // the tone generators were left behind, pick them up where we are
+        pulse1.stepTime = pulse2.stepTime = triangle.stepTime = noise.stepTime = now;
+        Nes().blip.Clear();
+        Nes().resampler.Clear();
+        frameBase = now;
+        level = 0;
+    }
+    timingOnly = on;
+    UpdateLevel(now);
+}
+
+void APU::ResumeOutput(const APU& before, uint64_t now) {
+    RunUntil(now);
+    pulse1.pos = before.pulse1.pos;
+    pulse2.pos = before.pulse2.pos;
+    triangle.pos = before.triangle.pos;
+    noise.lfsr = before.noise.lfsr;
+    pulse1.stepTime = before.pulse1.stepTime;
+    pulse2.stepTime = before.pulse2.stepTime;
+    triangle.stepTime = before.triangle.stepTime;
+    noise.stepTime = before.noise.stepTime;
+    // the frames run again may end a few cycles off, never step in the past
+    pulse1.Advance(now);
+    pulse2.Advance(now);
+    triangle.Advance(now);
+    noise.Advance(now);
+
+    frameBase = now; // the blip buffer's frame ended wherever the state last did
+    level = before.level;
+    timingOnly = false;
+    UpdateLevel(now);
+}
+
+void APU::ClearOutputState() {
+    pulse1.pos = pulse2.pos = triangle.pos = 0;
+    noise.lfsr = 1;
+    pulse1.stepTime = pulse2.stepTime = triangle.stepTime = noise.stepTime = 0;
+    frameBase = 0;
+    level = 0;
+    timingOnly = false;
+}
+
+void APU::RunUntil(uint64_t end) {
+    if (end < time) return;
+
+    // only what the CPU can observe: frame sequencer steps and the DMC
+    if (timingOnly) {
+        CPU& bus = Nes().cpu;
+        while (frameNext <= end) {
+            dmc.Advance(frameNext, bus);
+            ClockFrameSequencer();
+        }
+        dmc.Advance(end, bus);
+        time = end;
+        UpdateNextEvent();
+        return;
+    }
+
+    for (;;) {
+        uint64_t t = std::min({ frameNext, pulse1.NextChange(), pulse2.NextChange(),
+                                triangle.NextChange(), noise.NextChange(), dmc.NextChange() });
+        if (t > end) break;
+
+        AdvanceChannels(t);
+        if (t == frameNext) ClockFrameSequencer();
+        UpdateLevel(t);
+    }
+
+    AdvanceChannels(end);
+    time = end;
+    UpdateNextEvent();
+}
+
+void APU::EndFrame(uint64_t t) {
+    RunUntil(t);
+    if (!timingOnly) Nes().blip.EndFrame(uint32_t(t - frameBase));
+    frameBase = t;
+}
+
+void APU::Write(uint16_t addr, uint8_t value, uint64_t now) {
+    RunUntil(now);
+
+    switch (addr) {
+        case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+            pulse1.Write(addr & 3, value);
+            break;
+        case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+            pulse2.Write(addr & 3, value);
+            break;
+        case 0x4008: case 0x400A: case 0x400B:
+            triangle.Write(addr & 3, value);
+            break;
+        case 0x400C: case 0x400E: case 0x400F:
+            noise.Write(addr & 3, value);
+            break;
+        case 0x4010: case 0x4011: case 0x4012: case 0x4013:
+            dmc.Write(addr & 3, value);
+            break;
+
+        case 0x4015:
+            pulse1.enabled = value & 0x01;
+            pulse2.enabled = value & 0x02;
+            triangle.enabled = value & 0x04;
+            noise.enabled = value & 0x08;
+            if (!pulse1.enabled) pulse1.length = 0;
+            if (!pulse2.enabled) pulse2.length = 0;
+            if (!triangle.enabled) triangle.length = 0;
+            if (!noise.enabled) noise.length = 0;
+
+            dmc.irq = false;
+            if (value & 0x10) {
+                if (dmc.bytesRemaining == 0) dmc.Restart();
+                dmc.Fetch(Nes().cpu);
+            } else {
+                dmc.bytesRemaining = 0;
+            }
+            break;
+
+        case 0x4017:
+            // the real reset lands 3-4 cycles after the write
+            ResetFrameSequencer(now + 3, value);
+            break;
+    }
+
+    UpdateLevel(now);
+    UpdateNextEvent();
+}
+
+uint8_t APU::ReadStatus(uint64_t now) {
+    RunUntil(now);
+
+    uint8_t status = 0;
+    if (pulse1.length) status |= 0x01;
+    if (pulse2.length) status |= 0x02;
+    if (triangle.length) status |= 0x04;
+    if (noise.length) status |= 0x08;
+    if (dmc.bytesRemaining) status |= 0x10;
+    if (frameIRQ) status |= 0x40;
+    if (dmc.irq) status |= 0x80;
+
+    frameIRQ = false;
+    UpdateNextEvent();
+    return status;
+}
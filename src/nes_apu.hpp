@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "blip_buffer.hpp"
+#include "audio_resampler.hpp"
+
+#define CPU_CLOCK_NTSC 1789773
+
+// the blip buffer always synthesizes at this rate, the resampler takes it
+// from there to whatever the output wants
+#define APU_NATIVE_RATE (CPU_CLOCK_NTSC / 32.0)
+
+#define APU_NEVER UINT64_MAX
+
+class CPU;
+class Console;
+
+struct Envelope {
+    bool start = false;
+    bool loop = false;     // doubles as the length counter halt flag
+    bool constant = false;
+    uint8_t period = 0;    // also the constant volume
+    uint8_t divider = 0;
+    uint8_t decay = 0;
+
+    void Write(uint8_t value);
+    void Clock();
+    uint8_t Volume() const { return constant ? period : decay; }
+};
+
+struct PulseChannel {
+    bool onesComplement = false; // pulse 1 negates with -c-1
+    bool enabled = false;
+    uint8_t length = 0;
+    uint8_t duty = 0;
+    uint8_t pos = 0;
+    uint16_t period = 0;
+    Envelope env;
+
+    bool sweepEnabled = false;
+    bool sweepNegate = false;
+    bool sweepReload = false;
+    uint8_t sweepPeriod = 0;
+    uint8_t sweepShift = 0;
+    uint8_t sweepDivider = 0;
+
+    uint64_t stepTime = 0; // cpu cycle of the next sequencer step
+
+    void Write(int reg, uint8_t value);
+    void Advance(uint64_t t);
+    void ClockSweep();
+    uint16_t SweepTarget() const;
+    bool Muted() const { return length == 0 || period < 8 || SweepTarget() > 0x7FF; }
+    uint8_t Output() const;
+    uint64_t NextChange() const;
+};
+
+struct TriangleChannel {
+    bool enabled = false;
+    uint8_t length = 0;
+    bool control = false;
+    uint8_t linearPeriod = 0;
+    uint8_t linear = 0;
+    bool linearReload = false;
+    uint8_t pos = 0;
+    uint16_t period = 0;
+
+    uint64_t stepTime = 0;
+
+    void Write(int reg, uint8_t value);
+    void Advance(uint64_t t);
+    void ClockLinear();
+    bool Running() const { return length > 0 && linear > 0 && period >= 2; }
+    uint8_t Output() const;
+    uint64_t NextChange() const;
+};
+
+struct NoiseChannel {
+    bool enabled = false;
+    uint8_t length = 0;
+    bool mode = false;
+    uint16_t period = 4;
+    uint16_t lfsr = 1;
+    Envelope env;
+
+    uint64_t stepTime = 0;
+
+    void Write(int reg, uint8_t value);
+    void Advance(uint64_t t);
+    uint8_t Output() const;
+    uint64_t NextChange() const;
+};
+
+struct DMCChannel {
+    bool irqEnabled = false;
+    bool loop = false;
+    bool irq = false;
+    uint16_t period = 428;
+    uint16_t sampleAddr = 0xC000;
+    uint16_t sampleLength = 1;
+
+    uint16_t addr = 0;
+    uint16_t bytesRemaining = 0;
+    uint8_t buffer = 0;
+    bool bufferEmpty = true;
+    uint8_t shift = 0;
+    uint8_t bitsRemaining = 8;
+    bool silence = true;
+    uint8_t level = 0;
+
+    uint64_t stepTime = 0;
+    uint32_t stall = 0; // cpu cycles stolen by sample fetches
+
+    void Write(int reg, uint8_t value);
+    void Restart();
+    void Fetch(CPU& bus);
+    void Advance(uint64_t t, CPU& bus);
+    bool Idle() const { return silence && bufferEmpty && bytesRemaining == 0; }
+    uint64_t NextChange() const { return Idle() ? APU_NEVER : stepTime; }
+    uint64_t NextFetch() const;
+};
+
+// 2A03 sound. the APU is not ticked with the CPU, it is caught up lazily
+// (register access, frame end, or when the CPU reaches NextEvent) and jumps
+// from one output change to the next. every change of the mixed level is
+// handed to the blip buffer as a single band limited step. the blip buffer
+// and resampler belong to the console, so everything here is plain state.
+class APU {
+public:
+    Console& Nes();
+
+    void reset(uint64_t now);
+    void SetSampleRate(double rate);
+    void AdjustSampleRate(double rate);
+
+    void Write(uint16_t addr, uint8_t value, uint64_t now);
+    uint8_t ReadStatus(uint64_t now);
+
+    void RunUntil(uint64_t t);
+    void EndFrame(uint64_t t);
+
+    // output rate samples, runs whatever the blip buffer has through the resampler
+    size_t ReadSamples(int16_t* out, size_t max);
+
+    bool IRQ() const { return frameIRQ || dmc.irq; }
+
+    // timing only: length counters, frame sequencer, IRQs and DMC fetches keep
+    // running exactly as before, the waveforms aren't generated and no samples
+    // come out. for runs nobody listens to
+    void SetTimingOnly(bool on, uint64_t now);
+    bool TimingOnly() const { return timingOnly; }
+
+    // live again after a timing only run that replaced the state (a netplay
+    // rollback). before is this APU as it was, the waveforms and the level
+    // carry on from there and the blip buffer and resampler aren't cleared,
+    // so the sound goes on without a click
+    void ResumeOutput(const APU& before, uint64_t now);
+
+    // zeroes what only live output keeps (tone generator phase, the blip
+    // frame, the mode itself), so states from consoles in either mode compare
+    // equal when everything the CPU can see is
+    void ClearOutputState();
+
+    // stolen cycles the CPU still has to pay for
+    uint32_t TakeStall() {
+        uint32_t s = dmc.stall;
+        dmc.stall = 0;
+        return s;
+    }
+
+    // earliest cycle at which the APU can raise an IRQ or need the bus
+    uint64_t NextEvent() const { return nextEvent; }
+
+private:
+    uint64_t nextEvent = APU_NEVER;
+
+    PulseChannel pulse1, pulse2;
+    TriangleChannel triangle;
+    NoiseChannel noise;
+    DMCChannel dmc;
+
+    bool fiveStep = false;
+    bool irqInhibit = false;
+    bool frameIRQ = false;
+    uint8_t frameStep = 0;
+    uint64_t frameNext = 0;
+
+    uint64_t time = 0;      // how far the APU has been run
+    uint64_t frameBase = 0; // cpu cycle of the blip frame start
+    int level = 0;          // last mixed level handed to the blip buffer
+    bool timingOnly = false;
+
+    void AdvanceChannels(uint64_t t);
+    void ClockQuarterFrame();
+    void ClockHalfFrame();
+    void ClockFrameSequencer();
+    void ResetFrameSequencer(uint64_t t, uint8_t value);
+    void UpdateLevel(uint64_t t);
+    void UpdateNextEvent();
+};
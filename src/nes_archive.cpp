@@ -0,0 +1,497 @@
+#include "nes_archive.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+// the largest iNES image there is: header, trainer, 255 PRG and 255 CHR
+// pages. nothing inflates past it, so a bomb can't eat the memory
+#define ARCHIVE_OUTPUT_MAX (16 + 512 + 255 * 0x4000 + 255 * 0x2000)
+
+// the sizes in headers and trailers aren't trusted past what the data could
+// inflate to (deflate tops out near 1032:1) or the largest ROM
+static size_t ReserveSize(uint32_t claimed, size_t compressed) {
+    return std::min<size_t>({ claimed, compressed * 1032, ARCHIVE_OUTPUT_MAX });
+}
+
+static bool Room(const std::vector<uint8_t>& out, size_t more) {
+    if (out.size() + more <= ARCHIVE_OUTPUT_MAX) return true;
+    std::cerr << "Archive holds more than any ROM could be\n";
+    return false;
+}
+
+// built once, on first use from whichever thread gets there
+static const uint32_t* CrcTable() {
+    static const auto table = [] {
+        struct { uint32_t v[256]; } t;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            t.v[i] = c;
+        }
+        return t;
+    }();
+    return table.v;
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc) {
+    const uint32_t* crcTable = CrcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// lsb-first bit reader over a chunked istream. pads with zeros past the end
+// and remembers it, so a truncated file shows up as an error instead of a hang.
+class BitReader {
+public:
+    explicit BitReader(std::istream& s) : in(s) {}
+
+    // true once bits from past the end were actually consumed
+    bool Overrun() const { return overrun; }
+
+    int Byte() {
+        if (pos == len && (eof || !Refill())) {
+            overrun = true;
+            return 0;
+        }
+        return buf[pos++];
+    }
+
+    // lookahead may run past the end of the file, that's only an error if
+    // the padding bits get used
+    void Need(int n) {
+        while (count < n) {
+            if (pos == len && (eof || !Refill())) {
+                pad += 8;
+            } else {
+                bits |= uint64_t(buf[pos++]) << count;
+            }
+            count += 8;
+        }
+    }
+
+    uint32_t Peek(int n) {
+        Need(n);
+        return uint32_t(bits & ((1ull << n) - 1));
+    }
+
+    void Drop(int n) {
+        bits >>= n;
+        count -= n;
+        if (pad > count) {
+            overrun = true;
+        }
+    }
+
+    uint32_t Bits(int n) {
+        if (n == 0) return 0;
+        uint32_t v = Peek(n);
+        Drop(n);
+        return v;
+    }
+
+    void AlignByte() { Drop(count & 7); }
+
+    // whole bytes, including ones already pulled into the bit buffer
+    uint8_t AlignedByte() {
+        if (count >= 8) return uint8_t(Bits(8));
+        return uint8_t(Byte());
+    }
+
+    bool Skip(uint64_t n) {
+        while (n > 0 && count >= 8) {
+            Drop(8);
+            n--;
+        }
+        while (n > 0) {
+            if (pos == len && (eof || !Refill())) {
+                overrun = true;
+                return false;
+            }
+            size_t step = size_t(std::min<uint64_t>(n, len - pos));
+            pos += step;
+            n -= step;
+        }
+        return true;
+    }
+
+private:
+    bool Refill() {
+        in.read(reinterpret_cast<char*>(buf), sizeof(buf));
+        len = size_t(in.gcount());
+        pos = 0;
+        eof = len == 0;
+        return !eof;
+    }
+
+    std::istream& in;
+    uint8_t buf[0x4000];
+    size_t pos = 0, len = 0;
+    uint64_t bits = 0;
+    int count = 0;
+    int pad = 0;
+    bool eof = false;
+    bool overrun = false;
+};
+
+#define HUFF_FAST_BITS 9
+
+// canonical huffman code, codes up to HUFF_FAST_BITS long resolve with one
+// table lookup, longer ones fall back to walking the code lengths
+struct Huffman {
+    uint16_t counts[16];
+    uint16_t symbols[288];
+    uint16_t fast[1 << HUFF_FAST_BITS]; // (length << 9) | symbol, 0 = slow path
+
+    bool Build(const uint8_t* lengths, int n) {
+        std::memset(counts, 0, sizeof(counts));
+        std::memset(fast, 0, sizeof(fast));
+        for (int i = 0; i < n; i++) counts[lengths[i]]++;
+        if (counts[0] == n) return true; // empty code, only valid if never used
+
+        int left = 1;
+        for (int len = 1; len < 16; len++) {
+            left <<= 1;
+            left -= counts[len];
+            if (left < 0) return false; // over subscribed
+        }
+
+        uint16_t offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + counts[len];
+        for (int i = 0; i < n; i++)
+            if (lengths[i]) symbols[offs[lengths[i]]++] = uint16_t(i);
+
+        int code = 0, index = 0;
+        for (int len = 1; len <= HUFF_FAST_BITS; len++) {
+            for (int k = 0; k < counts[len]; k++, code++, index++) {
+                int rev = 0;
+                for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+                for (int fill = rev; fill < (1 << HUFF_FAST_BITS); fill += 1 << len)
+                    fast[fill] = uint16_t((len << 9) | symbols[index]);
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    int Decode(BitReader& br) const {
+        uint16_t e = fast[br.Peek(HUFF_FAST_BITS)];
+        if (e) {
+            br.Drop(e >> 9);
+            return e & 0x1FF;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; len++) {
+            code |= int(br.Bits(1));
+            int count = counts[len];
+            if (code - count < first) return symbols[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+static const uint16_t lenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static bool InflateCodes(BitReader& br, std::vector<uint8_t>& out, const Huffman& lit, const Huffman& dist) {
+    for (;;) {
+        int sym = lit.Decode(br);
+        if (sym < 0 || br.Overrun()) return false;
+        if (sym < 256) {
+            if (!Room(out, 1)) return false;
+            out.push_back(uint8_t(sym));
+            continue;
+        }
+        if (sym == 256) return true;
+
+        sym -= 257;
+        if (sym >= 29) return false;
+        size_t len = lenBase[sym] + br.Bits(lenExtra[sym]);
+
+        int dsym = dist.Decode(br);
+        if (dsym < 0 || dsym >= 30) return false;
+        size_t d = distBase[dsym] + br.Bits(distExtra[dsym]);
+        if (d > out.size() || !Room(out, len)) return false;
+
+        // the output buffer doubles as the window, matches may overlap
+        size_t at = out.size();
+        out.resize(at + len);
+        uint8_t* to = out.data() + at;
+        const uint8_t* from = to - d;
+        for (size_t i = 0; i < len; i++) to[i] = from[i];
+    }
+}
+
+static bool InflateStored(BitReader& br, std::vector<uint8_t>& out) {
+    br.AlignByte();
+    uint32_t len = br.Bits(16);
+    uint32_t nlen = br.Bits(16);
+    if ((len ^ 0xFFFF) != nlen || !Room(out, len)) return false;
+    for (uint32_t i = 0; i < len; i++) out.push_back(br.AlignedByte());
+    return !br.Overrun();
+}
+
+static bool InflateDynamic(BitReader& br, std::vector<uint8_t>& out) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    int nlen = int(br.Bits(5)) + 257;
+    int ndist = int(br.Bits(5)) + 1;
+    int ncode = int(br.Bits(4)) + 4;
+    if (nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[288 + 32] = {};
+    for (int i = 0; i < ncode; i++) lengths[order[i]] = uint8_t(br.Bits(3));
+
+    Huffman lencode;
+    if (!lencode.Build(lengths, 19)) return false;
+
+    int index = 0;
+    while (index < nlen + ndist) {
+        int sym = lencode.Decode(br);
+        if (sym < 0 || br.Overrun()) return false;
+        if (sym < 16) {
+            lengths[index++] = uint8_t(sym);
+            continue;
+        }
+        uint8_t len = 0;
+        int rep;
+        if (sym == 16) {
+            if (index == 0) return false;
+            len = lengths[index - 1];
+            rep = 3 + int(br.Bits(2));
+        } else if (sym == 17) {
+            rep = 3 + int(br.Bits(3));
+        } else {
+            rep = 11 + int(br.Bits(7));
+        }
+        if (index + rep > nlen + ndist) return false;
+        while (rep--) lengths[index++] = len;
+    }
+    if (lengths[256] == 0) return false; // no end of block code
+
+    Huffman lit, dist;
+    if (!lit.Build(lengths, nlen)) return false;
+    if (!dist.Build(lengths + nlen, ndist)) return false;
+    return InflateCodes(br, out, lit, dist);
+}
+
+static bool InflateFixed(BitReader& br, std::vector<uint8_t>& out) {
+    static const auto fixed = [] {
+        struct { Huffman lit, dist; } f;
+        uint8_t lengths[288];
+        int i = 0;
+        for (; i < 144; i++) lengths[i] = 8;
+        for (; i < 256; i++) lengths[i] = 9;
+        for (; i < 280; i++) lengths[i] = 7;
+        for (; i < 288; i++) lengths[i] = 8;
+        f.lit.Build(lengths, 288);
+        std::memset(lengths, 5, 30);
+        f.dist.Build(lengths, 30);
+        return f;
+    }();
+    return InflateCodes(br, out, fixed.lit, fixed.dist);
+}
+
+static bool Inflate(BitReader& br, std::vector<uint8_t>& out) {
+    bool last;
+    do {
+        last = br.Bits(1);
+        bool ok;
+        switch (br.Bits(2)) {
+            case 0: ok = InflateStored(br, out); break;
+            case 1: ok = InflateFixed(br, out); break;
+            case 2: ok = InflateDynamic(br, out); break;
+            default: ok = false; break;
+        }
+        if (!ok || br.Overrun()) return false;
+    } while (!last);
+    return true;
+}
+
+static uint32_t ReadLE(BitReader& br, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= uint32_t(br.AlignedByte()) << (i * 8);
+    return v;
+}
+
+static bool ReadGzip(std::ifstream& file, std::vector<uint8_t>& out) {
+    // ISIZE sits in the trailer, peek at it so the ROM buffer is sized once
+    file.seekg(0, std::ios::end);
+    size_t fileSize = size_t(std::max<std::streamoff>(file.tellg(), 0));
+    file.seekg(-4, std::ios::end);
+    uint8_t isize[4] = {};
+    file.read(reinterpret_cast<char*>(isize), 4);
+    out.reserve(ReserveSize(isize[0] | (isize[1] << 8) | (isize[2] << 16) | (uint32_t(isize[3]) << 24), fileSize));
+    file.clear();
+    file.seekg(0, std::ios::beg);
+
+    BitReader br(file);
+    ReadLE(br, 2); // magic
+    uint8_t method = br.AlignedByte();
+    uint8_t flags = br.AlignedByte();
+    ReadLE(br, 4); // mtime
+    ReadLE(br, 2); // xfl, os
+    if (method != 8) {
+        std::cerr << "Unsupported gzip compression method\n";
+        return false;
+    }
+
+    if (flags & 0x04) br.Skip(ReadLE(br, 2)); // FEXTRA
+    if (flags & 0x08) while (br.AlignedByte() && !br.Overrun()) {} // FNAME
+    if (flags & 0x10) while (br.AlignedByte() && !br.Overrun()) {} // FCOMMENT
+    if (flags & 0x02) ReadLE(br, 2); // FHCRC
+
+    if (!Inflate(br, out)) {
+        std::cerr << "Corrupt gzip data\n";
+        return false;
+    }
+
+    br.AlignByte();
+    uint32_t crc = ReadLE(br, 4);
+    uint32_t size = ReadLE(br, 4);
+    if (br.Overrun() || size != uint32_t(out.size()) || crc != Crc32(out.data(), out.size())) {
+        std::cerr << "gzip checksum mismatch\n";
+        return false;
+    }
+    return true;
+}
+
+static bool EndsWithNes(const std::string& name) {
+    if (name.size() < 4) return false;
+    std::string ext = name.substr(name.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return ext == ".nes";
+}
+
+// walks the local headers front to back instead of using the central
+// directory, that way the member is inflated in the same pass that finds it
+static bool ReadZip(std::ifstream& file, std::vector<uint8_t>& out) {
+    BitReader br(file);
+    std::vector<uint8_t> scratch;
+
+    for (;;) {
+        uint32_t sig = ReadLE(br, 4);
+        if (br.Overrun() || sig != 0x04034B50) break; // central directory or junk
+
+        ReadLE(br, 2); // version
+        uint16_t flags = uint16_t(ReadLE(br, 2));
+        uint16_t method = uint16_t(ReadLE(br, 2));
+        ReadLE(br, 4); // time, date
+        uint32_t crc = ReadLE(br, 4);
+        uint32_t csize = ReadLE(br, 4);
+        uint32_t usize = ReadLE(br, 4);
+        uint16_t nameLen = uint16_t(ReadLE(br, 2));
+        uint16_t extraLen = uint16_t(ReadLE(br, 2));
+
+        std::string name;
+        for (int i = 0; i < nameLen; i++) name.push_back(char(br.AlignedByte()));
+        br.Skip(extraLen);
+        if (br.Overrun()) break;
+
+        bool wanted = EndsWithNes(name) && (method == 0 || method == 8) && !(flags & 0x01);
+        bool sizesLater = (flags & 0x08) != 0; // sizes/crc in a data descriptor after the data
+
+        if (!wanted) {
+            if (!sizesLater) {
+                if (!br.Skip(csize)) break;
+                continue;
+            }
+            // can't know where a stored member ends without its size
+            if (method != 8) break;
+            scratch.clear();
+            if (!Inflate(br, scratch)) break;
+            br.AlignByte();
+            if (ReadLE(br, 4) != 0x08074B50) ReadLE(br, 8);
+            else ReadLE(br, 12);
+            continue;
+        }
+
+        if (method == 0 && sizesLater) {
+            std::cerr << "Unsupported zip entry: " << name << "\n";
+            return false;
+        }
+
+        out.clear();
+        if (!sizesLater) out.reserve(ReserveSize(usize, csize));
+
+        bool ok;
+        if (method == 0) {
+            if (!Room(out, csize)) return false;
+            out.resize(csize);
+            for (uint32_t i = 0; i < csize; i++) out[i] = br.AlignedByte();
+            ok = !br.Overrun();
+        } else {
+            ok = Inflate(br, out);
+        }
+        if (!ok) {
+            std::cerr << "Corrupt zip entry: " << name << "\n";
+            return false;
+        }
+
+        if (sizesLater) {
+            br.AlignByte();
+            uint32_t v = ReadLE(br, 4);
+            if (v == 0x08074B50) v = ReadLE(br, 4); // the signature is optional
+            crc = v;
+            ReadLE(br, 8);
+        }
+        if (crc != Crc32(out.data(), out.size())) {
+            std::cerr << "zip checksum mismatch: " << name << "\n";
+            return false;
+        }
+        std::cerr << "Using " << name << " from zip\n";
+        return true;
+    }
+
+    std::cerr << "No .nes file in zip\n";
+    return false;
+}
+
+bool ReadROMFile(const std::string& filename, std::vector<uint8_t>& out) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Failed to open ROM: " << filename << "\n";
+        return false;
+    }
+
+    std::streamsize fsize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    uint8_t magic[4] = {};
+    file.read(reinterpret_cast<char*>(magic), 4);
+    file.clear();
+    file.seekg(0, std::ios::beg);
+
+    if (fsize >= 18 && magic[0] == 0x1F && magic[1] == 0x8B) {
+        return ReadGzip(file, out);
+    }
+    if (fsize >= 30 && magic[0] == 'P' && magic[1] == 'K' && magic[2] == 3 && magic[3] == 4) {
+        return ReadZip(file, out);
+    }
+
+    out.resize(size_t(fsize));
+    if (!file.read(reinterpret_cast<char*>(out.data()), fsize)) {
+        std::cerr << "Failed to read ROM\n";
+        return false;
+    }
+    return true;
+}
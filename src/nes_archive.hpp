@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// reads a ROM file into out. plain .nes files are read as is, gzip files and
+// zip archives (stored or deflate) are inflated on the fly while reading, so
+// compressed sets never need a temp file. for zips the first *.nes member wins.
+bool ReadROMFile(const std::string& filename, std::vector<uint8_t>& out);
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
@@ -0,0 +1,313 @@
+#include "nes_bisect.hpp"
+#include "nes_console.hpp"
+#include "nes_movie.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+
+#define HASH_LOG_HEADER "# MeowNES hash log v1"
+
+// the same pad sequence everywhere: std::mt19937 output is fixed by the standard
+static uint8_t SeededPad(std::mt19937& rng, uint8_t pad) {
+    return rng() % 20 == 0 ? uint8_t(rng()) : pad;
+}
+
+static void PrintHashLogUsage() {
+    std::cerr << "usage: MeowNES --hash-log rom.nes [options]\n"
+              << "  --frames N       frames to run (default 3600)\n"
+              << "  --seed S         random pad input from seed S (default 0, no input)\n"
+              << "  --movie FILE     input from a movie, from its first frame\n"
+              << "  --out FILE       where the log goes (default stdout)\n"
+              << "  --trace-frame F  also hash after every instruction of frame F\n"
+              << "  --dump F K FILE  write the raw state after instruction K of frame F\n";
+}
+
+int RunHashLog(const Console& cart, int argc, char** argv) {
+    long frames = 3600;
+    uint32_t seed = 0;
+    std::string out, moviePath;
+    long traceFrame = -1;
+    long dumpFrame = -1, dumpStep = -1;
+    std::string dumpPath;
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--frames" && hasValue) frames = std::atol(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--out" && hasValue) out = argv[++i];
+        else if (arg == "--movie" && hasValue) moviePath = argv[++i];
+        else if (arg == "--trace-frame" && hasValue) traceFrame = std::atol(argv[++i]);
+        else if (arg == "--dump" && i + 3 < argc) {
+            dumpFrame = std::atol(argv[++i]);
+            dumpStep = std::atol(argv[++i]);
+            dumpPath = argv[++i];
+        } else {
+            PrintHashLogUsage();
+            return 1;
+        }
+    }
+
+    std::ofstream file;
+    if (!out.empty()) {
+        file.open(out);
+        if (!file) {
+            std::cerr << "Can't write " << out << "\n";
+            return 1;
+        }
+    }
+    std::ostream& log = out.empty() ? std::cout : file;
+
+    auto nes = std::make_unique<Console>();
+    nes->LoadCartridge(cart.rom, cart.ppu.VerticalMirror, nullptr);
+
+    MoviePlayer movie;
+    if (!moviePath.empty() && (!movie.Open(moviePath, *nes) || !movie.Seek(*nes, 0))) return 1;
+
+    std::mt19937 rng(seed);
+    uint8_t pad = 0;
+    char line[96];
+
+    log << HASH_LOG_HEADER << "\n";
+    snprintf(line, sizeof(line), "f 0 %016" PRIx64 "\n", nes->Hash());
+    log << line;
+
+    for (long f = 1; f <= frames && !nes->cpu.Halted; f++) {
+        if (movie.IsOpen()) {
+            if (!movie.Apply(*nes)) break;
+        } else {
+            if (seed) pad = SeededPad(rng, pad);
+            nes->controllers[0].state = nes->controllers[1].state = pad;
+        }
+
+        if (f == traceFrame || f == dumpFrame) {
+            // RunFrame an instruction at a time
+            nes->ppu.FrameReady = false;
+            for (long step = 1; !nes->ppu.FrameReady && !nes->cpu.Halted; step++) {
+                uint16_t pc = nes->cpu.ProgramCounter();
+                nes->cpu.Step();
+                if (f == traceFrame) {
+                    snprintf(line, sizeof(line), "i %ld %ld %04x %016" PRIx64 "\n", f, step, pc, nes->Hash());
+                    log << line;
+                }
+                if (f == dumpFrame && step == dumpStep) {
+                    std::vector<uint8_t> state(nes->StateSize());
+                    nes->saveState(state.data());
+                    std::ofstream(dumpPath, std::ios::binary).write(reinterpret_cast<char*>(state.data()), state.size());
+                }
+            }
+            nes->apu.EndFrame(nes->cpu.TotalCycles);
+        } else {
+            nes->cpu.RunFrame();
+        }
+
+        snprintf(line, sizeof(line), "f %ld %016" PRIx64 "\n", f, nes->Hash());
+        log << line;
+    }
+    return 0;
+}
+
+struct HashLog {
+    std::vector<uint64_t> frames;                 // by frame number
+    std::vector<std::pair<uint16_t, uint64_t>> steps; // pc and hash, by instruction - 1
+    long traceFrame = -1;
+};
+
+static bool ReadHashLog(const std::string& path, HashLog& log) {
+    std::ifstream in(path);
+    std::string line;
+    // whatever got printed to stdout ahead of the log is skipped
+    while (std::getline(in, line) && line != HASH_LOG_HEADER) {}
+    if (!in) {
+        std::cerr << path << " isn't a hash log\n";
+        return false;
+    }
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        char kind;
+        long frame;
+        ss >> kind >> frame;
+        if (kind == 'f') {
+            std::string hash;
+            ss >> hash;
+            if (frame != long(log.frames.size())) break; // truncated or out of order, keep what's sound
+            log.frames.push_back(std::strtoull(hash.c_str(), nullptr, 16));
+        } else if (kind == 'i') {
+            long step;
+            std::string pc, hash;
+            ss >> step >> pc >> hash;
+            log.traceFrame = frame;
+            log.steps.push_back({ uint16_t(std::strtoul(pc.c_str(), nullptr, 16)), std::strtoull(hash.c_str(), nullptr, 16) });
+        }
+    }
+    return true;
+}
+
+// first index where the two disagree, assuming that once states part they
+// stay apart. n when they agree all the way
+template <typename Same>
+static size_t Bisect(size_t n, Same same) {
+    if (n == 0 || same(n - 1)) return n;
+    if (!same(0)) return 0;
+    size_t lo = 0, hi = n - 1; // same(lo), !same(hi)
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (same(mid)) lo = mid;
+        else hi = mid;
+    }
+    return hi;
+}
+
+// names the byte at `offset` of a saveState buffer
+static std::string DescribeOffset(size_t offset, size_t prgRAMSize) {
+    char buf[96];
+    struct Part { const char* name; size_t start, size; };
+    const Part parts[] = {
+        { "cpu", offsetof(ConsoleState, cpu), sizeof(CPU) },
+        { "ppu", offsetof(ConsoleState, ppu), sizeof(PPU) },
+        { "apu", offsetof(ConsoleState, apu), sizeof(APU) },
+        { "controllers", offsetof(ConsoleState, controllers), sizeof(ConsoleState::controllers) },
+        { "prgBanks", offsetof(ConsoleState, prgBanks), sizeof(ConsoleState::prgBanks) },
+    };
+
+    size_t ram = offsetof(ConsoleState, cpu) + offsetof(CPU, RAM);
+    if (offset >= ram && offset < ram + 0x800) {
+        snprintf(buf, sizeof(buf), "cpu RAM $%04zx", offset - ram);
+        return buf;
+    }
+    for (const Part& p : parts) {
+        if (offset >= p.start && offset < p.start + p.size) {
+            snprintf(buf, sizeof(buf), "%s+0x%zx", p.name, offset - p.start);
+            return buf;
+        }
+    }
+    if (offset < sizeof(ConsoleState)) return "padding";
+    offset -= sizeof(ConsoleState);
+    if (offset < prgRAMSize) {
+        snprintf(buf, sizeof(buf), "PRG RAM $%04zx", 0x6000 + offset);
+        return buf;
+    }
+    snprintf(buf, sizeof(buf), "CHR RAM $%04zx", offset - prgRAMSize);
+    return buf;
+}
+
+static void CompareDumps(const std::string& a, const std::string& b) {
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::vector<uint8_t> da((std::istreambuf_iterator<char>(fa)), {}), db((std::istreambuf_iterator<char>(fb)), {});
+    if (da.size() != db.size() || da.size() < sizeof(ConsoleState)) {
+        std::cout << "state dumps differ in size (" << da.size() << " vs " << db.size() << "), the builds don't share a state layout\n";
+        return;
+    }
+
+    // what follows the state is PRG RAM if any, then CHR RAM if the cart has it
+    const PPU* ppu = reinterpret_cast<const PPU*>(da.data() + offsetof(ConsoleState, ppu));
+    size_t extra = da.size() - sizeof(ConsoleState);
+    size_t prgRAMSize = extra - (ppu->ChrIsRAM ? 0x2000 : 0);
+
+    int shown = 0;
+    for (size_t i = 0; i < da.size() && shown < 16; i++) {
+        if (da[i] == db[i]) continue;
+        printf("  %-24s %02x vs %02x\n", DescribeOffset(i, prgRAMSize).c_str(), da[i], db[i]);
+        shown++;
+    }
+}
+
+static bool RunBuild(const std::string& exe, const std::string& rom, const std::string& args) {
+    std::string cmd = "\"" + exe + "\" --hash-log \"" + rom + "\" " + args;
+    if (std::system(cmd.c_str()) != 0) {
+        std::cerr << "failed: " << cmd << "\n";
+        return false;
+    }
+    return true;
+}
+
+static void PrintHashBisectUsage() {
+    std::cerr << "usage: MeowNES --hash-bisect a.log b.log\n"
+              << "       MeowNES --hash-bisect --builds A B rom.nes [--frames N] [--seed S]\n";
+}
+
+int RunHashBisect(int argc, char** argv) {
+    std::string logA, logB, exeA, exeB, rom;
+    std::string frames = "3600", seed = "0";
+
+    if (argc >= 4 && std::string(argv[0]) == "--builds") {
+        exeA = argv[1];
+        exeB = argv[2];
+        rom = argv[3];
+        for (int i = 4; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            if (arg == "--frames") frames = argv[i + 1];
+            else if (arg == "--seed") seed = argv[i + 1];
+        }
+        auto tmp = std::filesystem::temp_directory_path();
+        logA = (tmp / "meownes-a.log").string();
+        logB = (tmp / "meownes-b.log").string();
+        std::string args = "--frames " + frames + " --seed " + seed;
+        if (!RunBuild(exeA, rom, args + " --out \"" + logA + "\"")) return 1;
+        if (!RunBuild(exeB, rom, args + " --out \"" + logB + "\"")) return 1;
+    } else if (argc == 2) {
+        logA = argv[0];
+        logB = argv[1];
+    } else {
+        PrintHashBisectUsage();
+        return 1;
+    }
+
+    HashLog a, b;
+    if (!ReadHashLog(logA, a) || !ReadHashLog(logB, b)) return 1;
+
+    size_t n = std::min(a.frames.size(), b.frames.size());
+    size_t frame = Bisect(n, [&](size_t f) { return a.frames[f] == b.frames[f]; });
+    if (frame == n) {
+        std::cout << "states agree for all " << (n ? n - 1 : 0) << " frames\n";
+        return 0;
+    }
+    std::cout << "first differing frame: " << frame << (frame == 0 ? " (power on)" : "") << "\n";
+    if (frame == 0) return 2;
+
+    // the instructions of that frame, from the builds or from the logs if they have them
+    if (!exeA.empty()) {
+        std::string args = "--frames " + std::to_string(frame) + " --seed " + seed + " --trace-frame " + std::to_string(frame);
+        if (!RunBuild(exeA, rom, args + " --out \"" + logA + "\"")) return 1;
+        if (!RunBuild(exeB, rom, args + " --out \"" + logB + "\"")) return 1;
+        a = HashLog();
+        b = HashLog();
+        if (!ReadHashLog(logA, a) || !ReadHashLog(logB, b)) return 1;
+    }
+    if (a.traceFrame != long(frame) || b.traceFrame != long(frame)) {
+        std::cout << "rerun both with --trace-frame " << frame << " for the instruction\n";
+        return 2;
+    }
+
+    size_t steps = std::min(a.steps.size(), b.steps.size());
+    size_t step = Bisect(steps, [&](size_t i) { return a.steps[i] == b.steps[i]; });
+    if (step == steps) {
+        if (a.steps.size() != b.steps.size()) {
+            std::cout << "same instructions, but the frame is " << a.steps.size() << " vs " << b.steps.size() << " long\n";
+        } else {
+            std::cout << "every instruction agrees, the frame end (APU catch up) differs\n";
+        }
+        return 2;
+    }
+    printf("first differing instruction: #%zu of frame %zu, pc $%04x vs $%04x\n",
+           step + 1, frame, a.steps[step].first, b.steps[step].first);
+
+    if (!exeA.empty()) {
+        auto tmp = std::filesystem::temp_directory_path();
+        std::string dumpA = (tmp / "meownes-a.state").string(), dumpB = (tmp / "meownes-b.state").string();
+        std::string args = "--frames " + std::to_string(frame) + " --seed " + seed + " --out \"" + logA + "\" --dump "
+            + std::to_string(frame) + " " + std::to_string(step + 1) + " ";
+        if (!RunBuild(exeA, rom, args + "\"" + dumpA + "\"")) return 1;
+        if (!RunBuild(exeB, rom, args + "\"" + dumpB + "\"")) return 1;
+        std::cout << "state after it:\n";
+        CompareDumps(dumpA, dumpB);
+    }
+    return 2;
+}
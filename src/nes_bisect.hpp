@@ -0,0 +1,15 @@
+#pragma once
+
+class Console;
+
+// `MeowNES --hash-log rom.nes ...`: runs the ROM headless and writes the
+// state hash after every frame, optionally the hash after every instruction
+// of one frame, and optionally a raw state dump at one instruction. input is
+// none, a pad pattern from a seed (the same in every build), or a movie
+int RunHashLog(const Console& cart, int argc, char** argv);
+
+// `MeowNES --hash-bisect a.log b.log`, or `--hash-bisect --builds A B rom.nes`
+// to produce the logs with two executables first. finds the first frame whose
+// hashes differ by bisection, then the first instruction in it, then which
+// part of the state went wrong there
+int RunHashBisect(int argc, char** argv);
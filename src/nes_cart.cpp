@@ -0,0 +1,74 @@
+#include "nes_cart.hpp"
+#include "nes_archive.hpp"
+#include "state_hash.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+std::shared_ptr<const ROMImage> MakeROMImage(std::vector<uint8_t> prg, std::vector<uint8_t> chr) {
+    auto image = std::make_shared<ROMImage>();
+    image->prg = std::move(prg);
+    image->chr = std::move(chr);
+    image->hash = HashBytes(image->chr.data(), image->chr.size(), HashBytes(image->prg.data(), image->prg.size()));
+    return image;
+}
+
+bool ParseINES(const std::vector<uint8_t>& data, Cartridge& cart) {
+    if (data.size() < 16) {
+        std::cerr << "ROM too small\n";
+        return false;
+    }
+    if (data[0] != 'N' || data[1] != 'E' || data[2] != 'S' || data[3] != 0x1A) {
+        std::cerr << "Invalid iNES header\n";
+        return false;
+    }
+
+    cart.prgPages = data[4];
+    cart.chrPages = data[5];
+    uint8_t flags6 = data[6];
+    uint8_t flags7 = data[7];
+
+    bool hasTrainer = (flags6 & 0x04) != 0;
+    cart.battery = (flags6 & 0x02) != 0;
+    cart.verticalMirror = (flags6 & 0x01) != 0;
+
+    cart.mapper = (flags7 & 0xF0) | (flags6 >> 4);
+    if (cart.mapper != 0) {
+        std::cerr << "Warning: mapper " << int(cart.mapper) << " detected. only mapper 0 (NROM) is supported by MeowNES.\n";
+    }
+
+    size_t offset = 16;
+    if (hasTrainer) {
+        if (data.size() < offset + 512) {
+            std::cerr << "ROM too small\n";
+            return false;
+        }
+        offset += 512;
+    }
+
+    size_t totalPrgSize = size_t(cart.prgPages) * 16 * 1024;
+    size_t totalChrSize = size_t(cart.chrPages) * 8 * 1024;
+
+    if (cart.prgPages == 0) {
+        std::cerr << "ROM has zero PRG pages.\n";
+        return false;
+    }
+    if (data.size() < offset + totalPrgSize + totalChrSize) {
+        std::cerr << "ROM too small\n";
+        return false;
+    }
+
+    // NROM: 16KB is mirrored at $C000, MapPRG wraps the banks for us
+    std::vector<uint8_t> prg(data.begin() + offset, data.begin() + offset + std::min<size_t>(totalPrgSize, 0x8000));
+    offset += totalPrgSize;
+
+    std::vector<uint8_t> chr;
+    if (cart.chrPages > 0) chr.assign(data.begin() + offset, data.begin() + offset + 0x2000);
+    cart.rom = MakeROMImage(std::move(prg), std::move(chr));
+    return true;
+}
+
+bool LoadCartridgeFile(const std::string& filename, Cartridge& cart) {
+    std::vector<uint8_t> data;
+    return ReadROMFile(filename, data) && ParseINES(data, cart);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// a cartridge's ROM. never changes once made, so every console running the
+// game points at the same one instead of holding a copy
+struct ROMImage {
+    std::vector<uint8_t> prg; // up to 32KB, 16KB carts aren't doubled
+    std::vector<uint8_t> chr; // 8KB, empty for CHR RAM
+    uint64_t hash = 0;        // of prg then chr, tells games apart
+};
+
+std::shared_ptr<const ROMImage> MakeROMImage(std::vector<uint8_t> prg, std::vector<uint8_t> chr);
+
+// an iNES file as NROM sees it
+struct Cartridge {
+    std::shared_ptr<const ROMImage> rom;
+    bool verticalMirror = false;
+    bool battery = false;
+    uint8_t mapper = 0;
+    uint8_t prgPages = 0;     // as the header says, in 16KB
+    uint8_t chrPages = 0;     // in 8KB
+};
+
+// checks the header and sizes, says what's wrong on stderr
+bool ParseINES(const std::vector<uint8_t>& data, Cartridge& cart);
+
+// ReadROMFile then ParseINES
+bool LoadCartridgeFile(const std::string& filename, Cartridge& cart);
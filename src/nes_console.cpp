@@ -0,0 +1,188 @@
+#include "nes_console.hpp"
+#include "state_hash.hpp"
+
+#include <cstring>
+
+static const uint8_t openBus[0x1000] = {}; // unmapped PRG reads as 0
+
+// what a console without a cartridge points at
+static const std::shared_ptr<const ROMImage>& NoROM() {
+    static const auto none = MakeROMImage({}, {});
+    return none;
+}
+
+Console::Console() {
+    rom = NoROM();
+    for (auto& p : prg) p = openBus;
+    chr = chrRAM.data();
+    blip.SetRates(CPU_CLOCK_NTSC, APU_NATIVE_RATE);
+    apu.SetSampleRate(44100);
+    PowerOn();
+}
+
+void Console::LoadCartridge(std::shared_ptr<const ROMImage> image, bool verticalMirror, uint8_t* saveRAM) {
+    rom = image ? std::move(image) : NoROM();
+    ppu.VerticalMirror = verticalMirror;
+    ppu.ChrIsRAM = rom->chr.size() < 0x2000;
+    chr = ppu.ChrIsRAM ? chrRAM.data() : rom->chr.data();
+
+    if (!saveRAM) wram.fill(0);
+    prgRAM = saveRAM ? saveRAM : wram.data();
+    PrgRAMDirty = false;
+    nsf = nullptr;
+
+    PowerOn();
+}
+
+void Console::PowerOn() {
+    // the header flags live in the PPU, and the audio mode is the frontend's choice
+    bool vertical = ppu.VerticalMirror;
+    bool chrIsRAM = ppu.ChrIsRAM;
+    bool timingOnly = apu.TimingOnly();
+
+    // copied as bytes so the padding is zero too, states are hashed and compared raw
+    static const ConsoleState fresh{};
+    std::memcpy(static_cast<ConsoleState*>(this), &fresh, sizeof(ConsoleState));
+    ppu.VerticalMirror = vertical;
+    ppu.ChrIsRAM = chrIsRAM;
+    for (int i = 0; i < 8; i++) MapPRG(i, uint8_t(i));
+    chrRAM.fill(0);
+
+    // before the reset, so switching catches nothing up and the state is the
+    // same as a live console's
+    if (timingOnly) apu.SetTimingOnly(true, 0);
+    Reset();
+}
+
+void Console::Reset() {
+    cpu.reset();
+    apu.reset(cpu.TotalCycles);
+}
+
+void Console::MapPRG(int slot, uint8_t bank) {
+    prgBanks[slot] = bank;
+    size_t count = rom->prg.size() / 0x1000;
+    prg[slot] = count ? &rom->prg[(bank % count) * 0x1000] : openBus;
+}
+
+size_t Console::StateSize() const {
+    return sizeof(ConsoleState) + (prgRAM ? 0x2000 : 0) + (ppu.ChrIsRAM ? 0x2000 : 0);
+}
+
+void Console::saveState(uint8_t* buffer) const {
+    std::memcpy(buffer, static_cast<const ConsoleState*>(this), sizeof(ConsoleState));
+    buffer += sizeof(ConsoleState);
+    if (prgRAM) {
+        std::memcpy(buffer, prgRAM, 0x2000);
+        buffer += 0x2000;
+    }
+    if (ppu.ChrIsRAM) std::memcpy(buffer, chrRAM.data(), 0x2000);
+}
+
+void Console::loadState(const uint8_t* buffer) {
+    std::memcpy(static_cast<ConsoleState*>(this), buffer, sizeof(ConsoleState));
+    buffer += sizeof(ConsoleState);
+    if (prgRAM) {
+        // battery RAM only needs writing back if the state really changes it
+        if (std::memcmp(prgRAM, buffer, 0x2000) != 0) {
+            std::memcpy(prgRAM, buffer, 0x2000);
+            PrgRAMDirty = true;
+        }
+        buffer += 0x2000;
+    }
+    if (ppu.ChrIsRAM) std::memcpy(chrRAM.data(), buffer, 0x2000);
+
+    // the pointers aren't state, rebuild them from what is
+    for (int i = 0; i < 8; i++) MapPRG(i, prgBanks[i]);
+}
+
+uint64_t Console::Hash() const {
+    uint64_t h = HashBytes(static_cast<const ConsoleState*>(this), sizeof(ConsoleState));
+    if (prgRAM) h = HashBytes(prgRAM, 0x2000, h);
+    if (ppu.ChrIsRAM) h = HashBytes(chrRAM.data(), 0x2000, h);
+    return h;
+}
+
+uint64_t Console::ROMHash() const {
+    return rom->hash;
+}
+
+void Console::CopyFrom(const Console& other) {
+    if (&other == this) return;
+    std::memcpy(static_cast<ConsoleState*>(this), static_cast<const ConsoleState*>(&other), sizeof(ConsoleState));
+    rom = other.rom;
+    nsf = other.nsf;
+    CPUPaused = other.CPUPaused;
+
+    if (ppu.ChrIsRAM) chrRAM = other.chrRAM;
+    chr = ppu.ChrIsRAM ? chrRAM.data() : rom->chr.data();
+    prgRAM = nullptr;
+    if (other.prgRAM) {
+        std::memcpy(wram.data(), other.prgRAM, 0x2000);
+        prgRAM = wram.data();
+    }
+    PrgRAMDirty = false;
+    for (int i = 0; i < 8; i++) MapPRG(i, prgBanks[i]);
+
+    // timing only consoles never look at these, and clear them on going live
+    if (!apu.TimingOnly()) {
+        blip.Clear();
+        resampler.Clear();
+    }
+}
+
+PooledConsole Console::clone(ConsolePool* pool) const {
+    PooledConsole copy = (pool ? *pool : ConsolePool::Shared()).Get();
+    copy->CopyFrom(*this);
+    return copy;
+}
+
+void ConsoleRelease::operator()(Console* nes) const {
+    if (pool) pool->Put(nes);
+    else delete nes;
+}
+
+ConsolePool::~ConsolePool() {
+    for (Console* nes : idle) delete nes;
+}
+
+PooledConsole ConsolePool::Get() {
+    Console* nes = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty()) {
+            nes = idle.back();
+            idle.pop_back();
+        }
+    }
+    if (!nes) nes = new Console();
+    return PooledConsole(nes, ConsoleRelease{this});
+}
+
+void ConsolePool::Put(Console* nes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(nes);
+}
+
+void ConsolePool::Reserve(size_t count) {
+    std::vector<Console*> made;
+    for (size_t have = Idle(); have + made.size() < count;) made.push_back(new Console());
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.insert(idle.end(), made.begin(), made.end());
+}
+
+size_t ConsolePool::Idle() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+ConsolePool& ConsolePool::Shared() {
+    static ConsolePool pool;
+    return pool;
+}
+
+Console console;
+
+CPU& cpu = console.cpu;
+PPU& ppu = console.ppu;
+APU& apu = console.apu;
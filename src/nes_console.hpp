@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <type_traits>
+
+#include "nes_cpu.hpp"
+#include "nes_ppu.hpp"
+#include "nes_apu.hpp"
+#include "nes_controller.hpp"
+#include "nes_cart.hpp"
+
+struct NSFImage;
+class Console;
+class ConsolePool;
+
+// hands a console back to the pool it came from instead of freeing it
+struct ConsoleRelease {
+    ConsolePool* pool = nullptr;
+    void operator()(Console* nes) const;
+};
+using PooledConsole = std::unique_ptr<Console, ConsoleRelease>;
+
+// everything that changes while the console runs, and nothing else. it is
+// plain data with no pointers, so a snapshot is a single memcpy. it starts on
+// a cache line and is kept small: snapshots, hashes and how many consoles
+// fit in cache all go by its size
+struct alignas(64) ConsoleState {
+    CPU cpu;
+    PPU ppu;
+    APU apu;
+    Controller controllers[2];
+    uint8_t prgBanks[8] = {}; // 4KB bank mapped at $8000 + slot * $1000
+};
+
+static_assert(std::is_standard_layout_v<ConsoleState>, "Console::Of needs offsetof on the state");
+static_assert(std::is_trivially_copyable_v<ConsoleState>, "console state is saved with memcpy");
+static_assert(sizeof(ConsoleState) <= 0x2000, "console state should stay under 8KB");
+
+// one whole NES. the parts only talk to the console they belong to, so any
+// number of them can run side by side (one per thread for batch jobs). the
+// frontend drives the global `console`.
+class Console : public ConsoleState {
+public:
+    Console();
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    // the console a part is embedded in
+    static Console& Of(CPU* p) { return FromState(p, offsetof(ConsoleState, cpu)); }
+    static Console& Of(PPU* p) { return FromState(p, offsetof(ConsoleState, ppu)); }
+    static Console& Of(APU* p) { return FromState(p, offsetof(ConsoleState, apu)); }
+
+    // an NROM cartridge, nullptr for none. no CHR means 8KB of CHR RAM.
+    // saveRAM is the battery RAM for $6000-$7FFF, without one wram is
+    // cleared and sits there instead. powers on
+    void LoadCartridge(std::shared_ptr<const ROMImage> image, bool verticalMirror, uint8_t* saveRAM);
+    void Reset();
+
+    // every part back to how it comes up when switched on, with the same
+    // cartridge in. battery RAM keeps what it has
+    void PowerOn();
+
+    // bank is taken modulo the PRG size
+    void MapPRG(int slot, uint8_t bank);
+
+    // the ConsoleState, then PRG RAM and CHR RAM when the cartridge has them.
+    // the ROM isn't in it, so a state only loads back into the same game
+    size_t StateSize() const;
+    void saveState(uint8_t* buffer) const;
+    void loadState(const uint8_t* buffer);
+
+    // of exactly what saveState writes, so equal states hash equal
+    uint64_t Hash() const;
+
+    // of the PRG and CHR ROM, tells which game a saved state or movie belongs to
+    uint64_t ROMHash() const;
+
+    // makes this console the same as other, running the same ROM. cartridge
+    // RAM is copied into its own (battery RAM too, so nothing it does gets
+    // saved) and no audio is carried over
+    void CopyFrom(const Console& other);
+
+    // an independent copy for tree search, from pool (nullptr: a shared one).
+    // it shares nothing mutable with this console, so it can run on any
+    // thread. this one must not be running while it's copied
+    PooledConsole clone(ConsolePool* pool = nullptr) const;
+
+    // laid out hot to cold: the state, then what every memory access goes
+    // through, then the cartridge RAM, then audio output which timing only
+    // consoles never touch
+
+    // cartridge
+    alignas(64) const uint8_t* prg[8]; // what the CPU sees at $8000-$FFFF, follows prgBanks
+    const uint8_t* chr;         // pattern tables, chrROM or chrRAM
+    uint8_t* prgRAM = nullptr;  // $6000-$7FFF, battery RAM or wram
+    std::shared_ptr<const ROMImage> rom; // shared with every console running the game, never null
+
+    // set while an NSF is loaded, $5FF8-$5FFF switch its banks
+    const NSFImage* nsf = nullptr;
+
+    bool CPUPaused = false;
+    bool PrgRAMDirty = false; // written since the frontend last looked
+
+    alignas(64) std::array<uint8_t, 0x2000> chrRAM{};
+    std::array<uint8_t, 0x2000> wram{}; // $6000-$7FFF for carts whose RAM isn't saved
+
+    BlipBuffer blip;
+    AudioResampler resampler;
+
+private:
+    static Console& FromState(void* part, size_t offset) {
+        return static_cast<Console&>(*reinterpret_cast<ConsoleState*>(static_cast<char*>(part) - offset));
+    }
+};
+
+// consoles kept for reuse. making one builds audio filters and allocates
+// ~50KB, far more than a clone copies into it. any thread can take and give
+// back; it has to outlive the consoles it hands out
+class ConsolePool {
+public:
+    ConsolePool() = default;
+    ~ConsolePool();
+    ConsolePool(const ConsolePool&) = delete;
+    ConsolePool& operator=(const ConsolePool&) = delete;
+
+    // a console in whatever state it was given back in
+    PooledConsole Get();
+
+    // makes count consoles up front so a search doesn't pay for them mid-run
+    void Reserve(size_t count);
+
+    size_t Idle() const;
+
+    static ConsolePool& Shared();
+
+private:
+    friend struct ConsoleRelease;
+    void Put(Console* nes);
+
+    mutable std::mutex mutex;
+    std::vector<Console*> idle;
+};
@@ -1,12 +1,11 @@
 #include "nes_controller.hpp"
-
-Controller controllers[2];
+#include "main.hpp"
 
 void UpdateControllers(void) {
     const uint8_t* Keystate = SDL_GetKeyboardState(nullptr);
 
     for (unsigned char i=0;i<2;i++) {
-        Controller *ControllerP = &controllers[i];
+        Controller *ControllerP = &console.controllers[i];
         ControllerP->state = 0;
         if (Keystate[SDL_SCANCODE_Z]) ControllerP->state |= A_BUTTON;
         if (Keystate[SDL_SCANCODE_X]) ControllerP->state |= B_BUTTON;
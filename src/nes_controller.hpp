@@ -1,6 +1,6 @@
 #pragma once
 
-#include "nes_cpu.hpp"
+#include <cstdint>
 
 class Controller {
 public:
@@ -9,6 +9,5 @@ public:
     bool strobe = false;
 };
 
-extern Controller controllers[2];
-
+// fills in the frontend console's pads from the keyboard
 void UpdateControllers(void);
\ No newline at end of file
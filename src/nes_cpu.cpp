@@ -1,5 +1,6 @@
 #include "nes_cpu.hpp"
-#include "nes_controller.hpp"
+#include "nes_console.hpp"
+#include "nes_nsf.hpp"
 
 //#define NES_DEBUG
 
@@ -11,29 +12,51 @@
 #define DEBUG_LOG2(...) //printf(__VA_ARGS__); printf("\n");
 #endif
 
-CPU cpu;
+Console& CPU::Nes() {
+    return Console::Of(this);
+}
 
-void CPU::run(uint32_t maxCycles) {
-    uint32_t cycles_run = 0;
-    //uint32_t frame_ppu_counter = 0;
+void CPU::Step() {
+    PPU& ppu = Nes().ppu;
+    APU& apu = Nes().apu;
+
+    if (TotalCycles >= apu.NextEvent()) apu.RunUntil(TotalCycles);
+
+    bool prevNMIDetect = NMIDetector;
+    NMIDetector = ppu.Vblank && ppu.enableNMI;
+
+    if (!prevNMIDetect && NMIDetector) HandleNMI();
+    else if (apu.IRQ() && !(P & 0x04)) HandleIRQ();
+
+    uint8_t opcode = fetch();
+    execute(opcode);
+    cycles += apu.TakeStall();
 
-    while (cycles_run < maxCycles) {
-        if (!romIsLoaded || CPUPaused) return;
-        bool prevNMIDetect = NMIDetector;
-        NMIDetector = ppu.Vblank && ppu.enableNMI;
+    // three dots per cpu cycle
+    ppu.Run(uint32_t(cycles * 3));
 
-        if (!prevNMIDetect && NMIDetector) HandleNMI();
+    TotalCycles += cycles;
+    cycles = 0;
+}
 
-        uint8_t opcode = fetch();
-        execute(opcode);
+void CPU::run(uint32_t maxCycles) {
+    uint64_t start = TotalCycles;
 
-        ppu.Step();
-        ppu.Step();
-        ppu.Step();
+    while (TotalCycles - start < maxCycles) {
+        if (Halted || Nes().CPUPaused) return;
+        Step();
+    }
+}
 
-        cycles_run += cycles;
-        cycles = 0;
+// runs up to the start of vblank, the PPU renders whole frames from that state
+void CPU::RunFrame() {
+    PPU& ppu = Nes().ppu;
+    ppu.FrameReady = false;
+    while (!ppu.FrameReady) {
+        if (Halted || Nes().CPUPaused) break;
+        Step();
     }
+    Nes().apu.EndFrame(TotalCycles);
 }
 
 void CPU::execute(uint8_t opcode)
@@ -1753,11 +1776,10 @@ void CPU::execute(uint8_t opcode)
     }
 
     default:
-        char errorMsg[64];
-        sprintf(errorMsg, "Unimplemented Opcode: 0x%02X\n", opcode);
-        romIsLoaded = false;
+        // the frontend notices Halted and tells the user
+        std::cerr << "Unimplemented Opcode: 0x" << std::hex << int(opcode) << std::dec << "\n";
         reset();
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR , "Fatal error", errorMsg, NULL);
+        Halted = true;
         break;
     }
     //  DEBUG_LOG("Proccessed 0x%x\n", opcode);
@@ -1772,9 +1794,17 @@ void CPU::SetZN(uint8_t value)
 uint8_t CPU::read(uint16_t addr)
 {
     if (addr < 0x2000) {
-        return memory[addr & 0x07FF];
+        return RAM[addr & 0x07FF];
+    }
+
+    Console& nes = Nes();
+    if (addr >= 0x8000) {
+        return nes.prg[(addr >> 12) & 7][addr & 0x0FFF];
     }
 
+    PPU& ppu = nes.ppu;
+    Controller* controllers = nes.controllers;
+
     if (addr >= 0x2000 && addr < 0x4000) {
         switch (addr & 7) {
             case 2: { // PPUSTATUS
@@ -1798,12 +1828,9 @@ uint8_t CPU::read(uint16_t addr)
                     ret = ppu.ReadBuffer;
                     uint16_t nt = vaddr & 0x0FFF;
                     if (vaddr < 0x2000)
-                        ppu.ReadBuffer = ppu.ChrROM[vaddr];
-                    else {
-                        if (globalROM.Header[6] & 1) nt &= 0x7FF;
-                        else nt = (nt & 0x800) ? (nt - 0x400) : nt;
-                        ppu.ReadBuffer = ppu.VRAM[nt];
-                    }
+                        ppu.ReadBuffer = nes.chr[vaddr];
+                    else
+                        ppu.ReadBuffer = ppu.VRAM[ppu.MirrorNametable(nt)];
                 } else {
                     uint16_t pal = vaddr & 0x1F;
                     if ((pal & 0x13) == 0x10) pal &= ~0x10;
@@ -1823,7 +1850,7 @@ uint8_t CPU::read(uint16_t addr)
 
     switch (addr) {
         case 0x4015: // apu
-            return 0;
+            return nes.apu.ReadStatus(Now());
         case 0x4016: {
             uint8_t ret = controllers[0].shift & 1;
             if (!controllers[0].strobe) {
@@ -1840,16 +1867,28 @@ uint8_t CPU::read(uint16_t addr)
         }
     }
 
-    return memory[addr];
+    if (addr >= 0x6000 && nes.prgRAM) {
+        return nes.prgRAM[addr & 0x1FFF];
+    }
+
+    if (nes.nsf && addr >= NSF_IDLE_ADDR && addr < NSF_IDLE_ADDR + 3) {
+        return NSFIdleLoop[addr - NSF_IDLE_ADDR];
+    }
+
+    return 0; // open bus
 }
 
 void CPU::write(uint16_t addr, uint8_t value)
 {
     if (addr < 0x2000) {
-        memory[addr & 0x07FF] = value;
+        RAM[addr & 0x07FF] = value;
         return;
     }
 
+    Console& nes = Nes();
+    PPU& ppu = nes.ppu;
+    Controller* controllers = nes.controllers;
+
     if (addr >= 0x2000 && addr < 0x4000) {
         switch (addr & 7) {
             case 0: // PPUCTRL
@@ -1905,17 +1944,11 @@ void CPU::write(uint16_t addr, uint8_t value)
                 uint16_t vaddr = ppu.VRAMAddr & 0x3FFF;
 
                 if (vaddr < 0x2000) {
-                    if (globalROM.Header[5] == 0)
-                        ppu.ChrROM[vaddr] = value;
+                    if (ppu.ChrIsRAM)
+                        nes.chrRAM[vaddr] = value;
                 }
                 else if (vaddr < 0x3F00) {
-                    uint16_t nt = vaddr & 0x0FFF;
-                    if (globalROM.Header[6] & 1) { // vertical mirroring
-                        nt &= 0x7FF;
-                    } else { // horizontal
-                        nt = (nt & 0x800) ? (nt - 0x400) : nt;
-                    }
-                    ppu.VRAM[nt] = value;
+                    ppu.VRAM[ppu.MirrorNametable(vaddr & 0x0FFF)] = value;
                 }
                 else {
                     uint16_t pal = vaddr & 0x1F;
@@ -1937,9 +1970,9 @@ void CPU::write(uint16_t addr, uint8_t value)
                 uint16_t base = value << 8;
                 for (int i = 0; i < 256; i++)
                     ppu.OAM[i] = read(base + i);
+                cycles += 513;
                 break;
             }
-            case 0x4015: break; // apu status
             case 0x4016: {
                 controllers[0].strobe = value & 1;
                 if (controllers[0].strobe) {
@@ -1948,13 +1981,23 @@ void CPU::write(uint16_t addr, uint8_t value)
                 }
                 break;
             }
-            case 0x4017: break; // apu framecnt
+            default: // apu
+                nes.apu.Write(addr, value, Now());
+                break;
         }
         return;
     }
 
+    if (addr >= 0x5FF8 && addr < 0x6000) {
+        if (nes.nsf) nes.MapPRG(addr & 7, value);
+        return;
+    }
+
     if (addr >= 0x6000 && addr < 0x8000) {
-        memory[addr] = value;
+        if (nes.prgRAM) {
+            nes.prgRAM[addr & 0x1FFF] = value;
+            nes.PrgRAMDirty = true;
+        }
         return;
     }
 }
@@ -1967,11 +2010,11 @@ uint16_t CPU::read16(uint16_t addr)
 }
 
 void CPU::push(uint8_t value) {
-    memory[0x100 + SP] = value;
+    RAM[0x100 + SP] = value;
     SP--;
 }
 
 uint8_t CPU::pop() {
     SP++;
-    return memory[0x100 + SP];
+    return RAM[0x100 + SP];
 }
\ No newline at end of file
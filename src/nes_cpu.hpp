@@ -3,16 +3,20 @@
 #include <cstdint>
 #include <iostream>
 #include <array>
-#include "nes_ppu.hpp"
-#include "main.hpp"
+#include <algorithm>
+#include "nes.hpp"
 
 #include <stdio.h>
 
+class Console;
+
+// everything in here is console state and gets snapshotted with a plain copy,
+// so no pointers: the rest of the machine is found through Nes()
 class CPU {
 public:
-    CPU() { reset(); }
+    Console& Nes();
 
-    bool CPUPaused = false;
+    bool Halted = false; // hit an opcode it can't run, stays stopped until reset
 
     void reset() {
         A = X = Y = 0;
@@ -20,14 +24,22 @@ public:
         P = 0x24;
         PC = read16(0xFFFC);
         cycles = 0;
-    }
-
-    void LoadMem(const std::array<uint8_t, MEMORY_SIZE>& mem) {
-        memory = mem;
+        Halted = false;
     }
 
     bool NMIDetector = false;
 
+    // a JSR from outside the program: A and X set, returning to returnAddr
+    void Call(uint16_t addr, uint16_t returnAddr, uint8_t a, uint8_t x) {
+        returnAddr--; // rts adds one
+        push(returnAddr >> 8);
+        push(returnAddr & 0xFF);
+        A = a;
+        X = x;
+        PC = addr;
+    }
+    uint16_t ProgramCounter() const { return PC; }
+
     void HandleNMI() {
         write(0x100 + SP--, (PC >> 8) & 0xFF);
         write(0x100 + SP--, PC & 0xFF);
@@ -38,7 +50,22 @@ public:
         cycles += 7;
     }
 
+    void HandleIRQ() {
+        write(0x100 + SP--, (PC >> 8) & 0xFF);
+        write(0x100 + SP--, PC & 0xFF);
+        write(0x100 + SP--, (P & ~0x10) | 0x20);
+        P |= 0x04;
+        PC = read16(0xFFFE);
+        cycles += 7;
+    }
+
+    // cpu cycles since power on, never reset so the APU has a stable clock
+    uint64_t TotalCycles = 0;
+    uint64_t Now() const { return TotalCycles + cycles; }
+
+    void Step();
     void run(uint32_t maxCycles);
+    void RunFrame();
 
     void execute(uint8_t opcode);
     void SetZN(uint8_t value);
@@ -48,18 +75,17 @@ public:
     void push(uint8_t value);
     uint8_t pop();
 
-private:
-    uint8_t A, X, Y;
-    uint16_t PC;
-    uint8_t SP;
-    uint8_t P;
-    uint64_t cycles;
+    // public only so the console state stays standard layout
+    uint8_t A = 0, X = 0, Y = 0;
+    uint16_t PC = 0;
+    uint8_t SP = 0xFD;
+    uint8_t P = 0x24;
+    uint64_t cycles = 0;
 
-    std::array<uint8_t, MEMORY_SIZE> memory{};
+    std::array<uint8_t, 0x800> RAM{};
 
+private:
     uint8_t fetch() { return read(PC++); }
 
     uint16_t fetch16() { return fetch() | (fetch() << 8); }
 };
-
-extern CPU cpu;
\ No newline at end of file
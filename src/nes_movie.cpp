@@ -0,0 +1,302 @@
+#include "nes_movie.hpp"
+#include "nes_console.hpp"
+
+#include <iostream>
+#include <cstring>
+
+static void Put32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back(uint8_t(v >> (i * 8)));
+}
+
+static void Put64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out.push_back(uint8_t(v >> (i * 8)));
+}
+
+static void PutVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static uint32_t Get32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t Get64(const uint8_t* p) {
+    return uint64_t(Get32(p)) | uint64_t(Get32(p + 4)) << 32;
+}
+
+static bool Read(std::ifstream& f, void* p, size_t n) {
+    f.read(static_cast<char*>(p), std::streamsize(n));
+    return size_t(f.gcount()) == n;
+}
+
+static bool ReadVarint(std::ifstream& f, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = f.get();
+        if (c == EOF) return false;
+        v |= uint32_t(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool MovieWriter::Open(const std::string& path, const Console& nes, uint32_t keyframeInterval) {
+    Close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Can't write " << path << "\n";
+        return false;
+    }
+
+    interval = std::max(keyframeInterval, 1u);
+    frame = 0;
+    offset = 0;
+    index.clear();
+    runFrames = 0;
+    closing = false;
+    failed = false;
+
+    pending.clear();
+    pending.insert(pending.end(), { 'M', 'N', 'M', 'V' });
+    Put32(pending, MOVIE_VERSION);
+    Put64(pending, nes.ROMHash());
+    Put32(pending, interval);
+    Put32(pending, uint32_t(nes.StateSize()));
+
+    thread = std::thread(&MovieWriter::WriterLoop, this);
+    return true;
+}
+
+void MovieWriter::Record(const Console& nes) {
+    if (!IsOpen()) return;
+
+    if (frame % interval == 0) {
+        EndRun();
+        index.push_back({ frame, offset + pending.size() });
+        pending.push_back('K');
+        Put32(pending, frame);
+        size_t at = pending.size();
+        pending.resize(at + nes.StateSize());
+        nes.saveState(&pending[at]);
+        Hand();
+    }
+
+    uint8_t p0 = nes.controllers[0].state, p1 = nes.controllers[1].state;
+    if (runFrames && (p0 != runPads[0] || p1 != runPads[1])) EndRun();
+    runPads[0] = p0;
+    runPads[1] = p1;
+    runFrames++;
+    frame++;
+
+    if (pending.size() >= MOVIE_FLUSH_BYTES) Hand();
+}
+
+bool MovieWriter::Close() {
+    if (!IsOpen()) return true;
+
+    EndRun();
+    uint64_t indexOffset = offset + pending.size();
+    pending.push_back('X');
+    Put32(pending, uint32_t(index.size()));
+    for (const Keyframe& k : index) {
+        Put32(pending, k.frame);
+        Put64(pending, k.offset);
+    }
+    Put32(pending, frame);
+    Put64(pending, indexOffset);
+    pending.insert(pending.end(), { 'M', 'N', 'M', 'X' });
+    Hand();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    wake.notify_one();
+    thread.join();
+    file.close();
+    return !failed;
+}
+
+void MovieWriter::EndRun() {
+    if (!runFrames) return;
+    pending.push_back('R');
+    PutVarint(pending, runFrames);
+    pending.push_back(runPads[0]);
+    pending.push_back(runPads[1]);
+    runFrames = 0;
+}
+
+// the emulation thread never waits on the disk, only on this lock
+void MovieWriter::Hand() {
+    offset += pending.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(pending));
+    }
+    wake.notify_one();
+    pending.clear();
+}
+
+void MovieWriter::WriterLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&] { return closing || !queue.empty(); });
+        while (!queue.empty()) {
+            std::vector<uint8_t> chunk = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            file.write(reinterpret_cast<const char*>(chunk.data()), std::streamsize(chunk.size()));
+            if (!file) failed = true;
+            lock.lock();
+        }
+        if (closing) break;
+    }
+    file.flush();
+    if (!file) failed = true;
+}
+
+bool MoviePlayer::Open(const std::string& path, const Console& nes) {
+    Close();
+    file.open(path, std::ios::binary);
+    uint8_t h[MOVIE_HEADER_SIZE];
+    if (!file || !Read(file, h, sizeof(h)) || std::memcmp(h, "MNMV", 4) != 0) {
+        std::cerr << "Not a movie: " << path << "\n";
+        Close();
+        return false;
+    }
+    if (Get32(h + 4) != MOVIE_VERSION) {
+        std::cerr << "Unsupported movie version " << Get32(h + 4) << ": " << path << "\n";
+        Close();
+        return false;
+    }
+    if (Get64(h + 8) != nes.ROMHash()) {
+        std::cerr << "Movie was recorded with a different ROM: " << path << "\n";
+        Close();
+        return false;
+    }
+    if (Get32(h + 20) != nes.StateSize()) {
+        std::cerr << "Movie keyframes don't match this console's state: " << path << "\n";
+        Close();
+        return false;
+    }
+    interval = std::max(Get32(h + 16), 1u);
+    stateSize = Get32(h + 20);
+
+    // the index from the footer, or from reading through a file that was cut short
+    uint8_t footer[MOVIE_FOOTER_SIZE];
+    file.seekg(-MOVIE_FOOTER_SIZE, std::ios::end);
+    bool indexed = Read(file, footer, sizeof(footer)) && std::memcmp(footer + 12, "MNMX", 4) == 0;
+    if (indexed) {
+        frames = Get32(footer);
+        file.seekg(std::streamoff(Get64(footer + 4)));
+        uint8_t head[5];
+        indexed = Read(file, head, 5) && head[0] == 'X';
+        std::vector<uint8_t> entries(indexed ? size_t(Get32(head + 1)) * 12 : 0);
+        indexed = indexed && Read(file, entries.data(), entries.size());
+        for (size_t k = 0; indexed && k < entries.size() / 12; k++) {
+            indexed = Get32(&entries[k * 12]) == k * interval;
+            keyframes.push_back(Get64(&entries[k * 12 + 4]));
+        }
+        indexed = indexed && !keyframes.empty();
+    }
+    file.clear();
+    if (!indexed && !RebuildIndex()) {
+        std::cerr << "Movie has no keyframes: " << path << "\n";
+        Close();
+        return false;
+    }
+    state.resize(stateSize);
+    return true;
+}
+
+void MoviePlayer::Close() {
+    file.close();
+    file.clear();
+    keyframes.clear();
+    frames = frame = runLeft = 0;
+}
+
+bool MoviePlayer::RebuildIndex() {
+    keyframes.clear();
+    frames = 0;
+    file.seekg(0, std::ios::end);
+    uint64_t size = uint64_t(file.tellg());
+    file.seekg(MOVIE_HEADER_SIZE);
+
+    for (;;) {
+        uint64_t at = uint64_t(file.tellg());
+        int tag = file.get();
+        uint8_t b[4];
+        uint32_t n;
+        if (tag == 'K') {
+            if (at + 5 + stateSize > size) break; // the state itself is cut short
+            if (!Read(file, b, 4) || Get32(b) != keyframes.size() * interval || Get32(b) != frames) break;
+            file.seekg(stateSize, std::ios::cur);
+            keyframes.push_back(at);
+        } else if (tag == 'R') {
+            if (!ReadVarint(file, n) || !Read(file, b, 2)) break;
+            frames += n;
+        } else {
+            break;
+        }
+    }
+    file.clear();
+    return !keyframes.empty();
+}
+
+bool MoviePlayer::NextRun() {
+    for (;;) {
+        int tag = file.get();
+        if (tag == 'R') {
+            uint8_t pads[2];
+            if (!ReadVarint(file, runLeft) || !Read(file, pads, 2)) return false;
+            runPads[0] = pads[0];
+            runPads[1] = pads[1];
+            if (runLeft) return true;
+        } else if (tag == 'K') {
+            file.seekg(4 + stateSize, std::ios::cur);
+        } else {
+            return false;
+        }
+    }
+}
+
+bool MoviePlayer::Apply(Console& nes) {
+    if (frame >= frames) return false;
+    if (!runLeft && !NextRun()) return false;
+    nes.controllers[0].state = runPads[0];
+    nes.controllers[1].state = runPads[1];
+    runLeft--;
+    frame++;
+    return true;
+}
+
+bool MoviePlayer::Seek(Console& nes, uint32_t target) {
+    if (!IsOpen()) return false;
+    target = std::min(target, frames);
+
+    // keyframes are evenly spaced, no search
+    size_t k = std::min(size_t(target / interval), keyframes.size() - 1);
+    uint8_t head[5];
+    file.clear();
+    file.seekg(std::streamoff(keyframes[k]));
+    if (!Read(file, head, 5) || head[0] != 'K' || !Read(file, state.data(), stateSize)) return false;
+
+    // the keyframe brings the APU mode it was recorded in, the caller's stays
+    bool timingOnly = nes.apu.TimingOnly();
+    nes.loadState(state.data());
+    if (nes.apu.TimingOnly() != timingOnly) nes.apu.SetTimingOnly(timingOnly, nes.cpu.TotalCycles);
+    frame = Get32(head + 1);
+    runLeft = 0;
+
+    // everything the CPU can see comes out as it was in the recording, only
+    // the tone generators differ if the modes do. the sound is dropped
+    while (frame < target && !nes.cpu.Halted && Apply(nes)) nes.cpu.RunFrame();
+    nes.blip.Clear();
+    nes.resampler.Clear();
+    return frame == target;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Console;
+
+#define MOVIE_VERSION 2 // goes up whenever ConsoleState changes layout, keyframes hold it
+#define MOVIE_KEYFRAME_INTERVAL 180 // frames, a seek runs at most this many minus one
+#define MOVIE_HEADER_SIZE 24
+#define MOVIE_FOOTER_SIZE 16
+#define MOVIE_FLUSH_BYTES (64u << 10)
+
+// a movie is the pads of both players for every frame, and every
+// MOVIE_KEYFRAME_INTERVAL frames the whole state, so playback can start
+// anywhere without going back to the first frame. the file is
+//   header:    "MNMV", version, ROM hash (u64), keyframe interval, state size
+//   'R' run:   varint frames, pad 1, pad 2
+//   'K' key:   frame (u32), the state as saveState writes it, before that frame runs
+//   'X' index: count (u32), then frame (u32) and file offset (u64) per keyframe
+//   footer:    frames (u32), index offset (u64), "MNMX"
+// frame 0 is always a keyframe, so a movie starts wherever it was recorded.
+// runs never cross a keyframe. all numbers are little endian. a file cut short
+// (no footer) still plays, the index is rebuilt by reading it through.
+
+// appends as the game runs. the emulation thread only fills a buffer, a
+// thread of its own does the writing
+class MovieWriter {
+public:
+    ~MovieWriter() { Close(); }
+
+    bool Open(const std::string& path, const Console& nes, uint32_t keyframeInterval = MOVIE_KEYFRAME_INTERVAL);
+
+    // before every frame, once the pads are set for it
+    void Record(const Console& nes);
+
+    // writes the index, waits for the disk. false if anything failed to write
+    bool Close();
+
+    bool IsOpen() const { return thread.joinable(); }
+    uint32_t Frames() const { return frame; }
+
+private:
+    struct Keyframe {
+        uint32_t frame;
+        uint64_t offset;
+    };
+
+    uint32_t interval = MOVIE_KEYFRAME_INTERVAL;
+    uint32_t frame = 0;
+    uint64_t offset = 0;             // of the end of pending in the file
+    std::vector<uint8_t> pending;    // not handed to the writer yet
+    std::vector<Keyframe> index;
+    uint8_t runPads[2] = {};
+    uint32_t runFrames = 0;
+
+    std::ofstream file;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::vector<uint8_t>> queue;
+    bool closing = false;
+    std::atomic<bool> failed{false};
+
+    void EndRun();
+    void Hand();
+    void WriterLoop();
+};
+
+class MoviePlayer {
+public:
+    // the movie has to be of the game in `nes`
+    bool Open(const std::string& path, const Console& nes);
+    void Close();
+    bool IsOpen() const { return file.is_open(); }
+
+    uint32_t Frames() const { return frames; }
+    uint32_t Frame() const { return frame; }
+    uint32_t KeyframeInterval() const { return interval; }
+
+    // loads the keyframe at or before `target` and runs from it, headless,
+    // until the next frame to run is `target`
+    bool Seek(Console& nes, uint32_t target);
+
+    // the pads for the next frame, false at the end of the movie
+    bool Apply(Console& nes);
+
+private:
+    std::ifstream file;
+    uint32_t interval = MOVIE_KEYFRAME_INTERVAL;
+    uint32_t stateSize = 0;
+    uint32_t frames = 0;
+    uint32_t frame = 0;
+    std::vector<uint64_t> keyframes; // file offsets, keyframe k is frame k * interval
+    uint8_t runPads[2] = {};
+    uint32_t runLeft = 0;
+    std::vector<uint8_t> state;
+
+    bool RebuildIndex();
+    bool NextRun();
+};
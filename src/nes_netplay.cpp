@@ -0,0 +1,425 @@
+#include "nes_netplay.hpp"
+#include "nes_console.hpp"
+#include "state_hash.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define CloseSocket closesocket
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define CloseSocket close
+#endif
+
+#define NETPLAY_MAGIC0 'M'
+#define NETPLAY_MAGIC1 'N'
+#define NETPLAY_VERSION 1
+#define NETPLAY_HEADER 29 // magic, version, frame, ack, advantage, hash frame, hash, first input frame, count
+
+static void Put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = uint8_t(v >> (i * 8));
+}
+
+static uint32_t Get32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+bool NetplaySession::Open(uint16_t localPort, const std::string& peerHost, uint16_t peerPort, int localPlayer) {
+    Close();
+#ifdef _WIN32
+    static bool started = false;
+    WSADATA wsa;
+    if (!started && WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        std::cerr << "netplay: WSAStartup failed\n";
+        return false;
+    }
+    started = true;
+#endif
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* found = nullptr;
+    std::string port = std::to_string(peerPort);
+    if (getaddrinfo(peerHost.c_str(), port.c_str(), &hints, &found) != 0 || !found) {
+        std::cerr << "netplay: can't resolve " << peerHost << "\n";
+        return false;
+    }
+    peerAddr.assign(reinterpret_cast<uint8_t*>(found->ai_addr), reinterpret_cast<uint8_t*>(found->ai_addr) + sizeof(sockaddr_in));
+    freeaddrinfo(found);
+
+    sock = intptr_t(socket(AF_INET, SOCK_DGRAM, 0));
+    if (sock == -1) {
+        std::cerr << "netplay: can't create a socket\n";
+        return false;
+    }
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(localPort);
+    if (bind(sock, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+        std::cerr << "netplay: can't bind port " << localPort << "\n";
+        Close();
+        return false;
+    }
+
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+    fcntl(int(sock), F_SETFL, fcntl(int(sock), F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    player = localPlayer & 1;
+    return true;
+}
+
+void NetplaySession::Close() {
+    if (sock != -1) CloseSocket(sock);
+    sock = -1;
+    outbox.clear();
+}
+
+void NetplaySession::SetInputDelay(int frames) {
+    inputDelay = std::clamp(frames, 0, NETPLAY_MAX_DELAY);
+}
+
+void NetplaySession::Start(Console& nes) {
+    nes.PowerOn();
+
+    frame = remoteCount = ackedByPeer = peerFrame = 0;
+    firstWrong = UINT32_MAX;
+    peerAdvantage = 0;
+    peerSeen = false;
+    yieldedAt = UINT32_MAX;
+    std::memset(localInput, 0, sizeof(localInput));
+    std::memset(remoteInput, 0, sizeof(remoteInput));
+    std::memset(usedRemote, 0, sizeof(usedRemote));
+
+    nextHashFrame = 0;
+    lastHash = { UINT32_MAX, 0 };
+    localHashes.clear();
+    peerHashes.clear();
+    stats = NetplayStats();
+}
+
+// the confirmed input, or a guess that the pad is still held the same way
+uint8_t NetplaySession::RemoteFor(uint32_t f) const {
+    if (f < remoteCount) return remoteInput[f % NETPLAY_INPUT_RING];
+    return remoteCount ? remoteInput[(remoteCount - 1) % NETPLAY_INPUT_RING] : 0;
+}
+
+void NetplaySession::RunFrame(Console& nes, uint32_t f) {
+    uint8_t remote = RemoteFor(f);
+    usedRemote[f % NETPLAY_INPUT_RING] = remote;
+    nes.controllers[player].state = localInput[f % NETPLAY_INPUT_RING];
+    nes.controllers[player ^ 1].state = remote;
+
+    // after the pads are set, whatever the frontend left in them isn't hashed
+    std::vector<uint8_t>& snapshot = snapshots[f % NETPLAY_SNAPSHOTS];
+    snapshot.resize(nes.StateSize());
+    nes.saveState(snapshot.data());
+    nes.cpu.RunFrame();
+}
+
+void NetplaySession::Rollback(Console& nes) {
+    if (firstWrong >= frame) {
+        firstWrong = UINT32_MAX;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t from = firstWrong;
+    firstWrong = UINT32_MAX;
+    bool timingOnly = nes.apu.TimingOnly();
+    APU before = nes.apu;
+    nes.loadState(snapshots[from % NETPLAY_SNAPSHOTS].data());
+
+    // these frames were heard the first time round, they run without sound.
+    // the output then picks up where it stopped, nothing already made is lost
+    nes.apu.SetTimingOnly(true, nes.cpu.TotalCycles);
+    for (uint32_t f = from; f < frame; f++) RunFrame(nes, f);
+    if (!timingOnly) nes.apu.ResumeOutput(before, nes.cpu.TotalCycles);
+
+    stats.rollbacks++;
+    stats.framesResimulated += frame - from;
+    stats.maxRollback = std::max(stats.maxRollback, frame - from);
+    stats.resimMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.maxResimMs = std::max(stats.maxResimMs, stats.resimMs);
+}
+
+bool NetplaySession::AdvanceFrame(Console& nes, uint8_t pad) {
+    Receive();
+    Rollback(nes);
+    HashConfirmed();
+    CompareHashes();
+
+    // too far past the peer's input, or it hasn't confirmed enough of ours
+    bool wait = frame >= remoteCount + NETPLAY_MAX_ROLLBACK
+        || frame + inputDelay >= ackedByPeer + NETPLAY_INPUT_RING;
+
+    // time sync: latency shows up on both sides' advantage and cancels out, what's
+    // left is how far this side really is ahead. that side gives up a frame
+    // now and then so the two don't drift apart and keep rolling back
+    int advantage = int(frame) - int(peerFrame);
+    if (!wait && peerSeen && advantage - peerAdvantage >= 2 && frame % 4 == 0 && frame != yieldedAt) {
+        yieldedAt = frame;
+        wait = true;
+    }
+
+    if (wait) {
+        stats.stalls++;
+        Send();
+        Flush();
+        return false;
+    }
+
+    localInput[(frame + inputDelay) % NETPLAY_INPUT_RING] = pad;
+    RunFrame(nes, frame);
+    frame++;
+
+    Send();
+    Flush();
+    return true;
+}
+
+// a side without an audio device runs timing only, and rollbacks always do.
+// the hash leaves out what that changes, the rest has to match exactly
+static uint64_t SyncHash(const std::vector<uint8_t>& snapshot) {
+    static thread_local ConsoleState state;
+    std::memcpy(&state, snapshot.data(), sizeof(ConsoleState));
+    state.apu.ClearOutputState();
+    uint64_t h = HashBytes(&state, sizeof(ConsoleState));
+    return HashBytes(snapshot.data() + sizeof(ConsoleState), snapshot.size() - sizeof(ConsoleState), h);
+}
+
+// the state at the start of a frame, its pads included, is final once every
+// input up to its own is
+void NetplaySession::HashConfirmed() {
+    while (nextHashFrame < frame && nextHashFrame < remoteCount) {
+        if (frame - nextHashFrame <= NETPLAY_SNAPSHOTS) {
+            lastHash = { nextHashFrame, SyncHash(snapshots[nextHashFrame % NETPLAY_SNAPSHOTS]) };
+            localHashes.push_back(lastHash);
+            if (localHashes.size() > 16) localHashes.pop_front();
+        }
+        nextHashFrame += NETPLAY_HASH_INTERVAL;
+    }
+}
+
+void NetplaySession::CompareHashes() {
+    while (!localHashes.empty() && !peerHashes.empty()) {
+        StateHash& mine = localHashes.front();
+        StateHash& theirs = peerHashes.front();
+        if (mine.frame < theirs.frame) {
+            localHashes.pop_front();
+        } else if (theirs.frame < mine.frame) {
+            peerHashes.pop_front();
+        } else {
+            stats.hashesChecked++;
+            if (mine.hash != theirs.hash && stats.desyncFrame < 0) {
+                stats.desyncFrame = mine.frame;
+                std::cerr << "netplay: desync, states differ at frame " << mine.frame << "\n";
+            }
+            localHashes.pop_front();
+            peerHashes.pop_front();
+        }
+    }
+}
+
+void NetplaySession::Receive() {
+    if (sock == -1) return;
+    uint8_t buf[512];
+    for (;;) {
+        sockaddr_in from = {};
+        socklen_t fromLen = sizeof(from);
+        int n = int(recvfrom(sock, reinterpret_cast<char*>(buf), sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &fromLen));
+        if (n < 0) break;
+
+        const sockaddr_in* peer = reinterpret_cast<const sockaddr_in*>(peerAddr.data());
+        if (from.sin_port != peer->sin_port || from.sin_addr.s_addr != peer->sin_addr.s_addr) continue;
+        if (n < NETPLAY_HEADER || buf[0] != NETPLAY_MAGIC0 || buf[1] != NETPLAY_MAGIC1 || buf[2] != NETPLAY_VERSION) continue;
+        uint8_t count = buf[NETPLAY_HEADER - 1];
+        if (n < NETPLAY_HEADER + count) continue;
+
+        peerSeen = true;
+        peerFrame = std::max(peerFrame, Get32(buf + 3));
+        ackedByPeer = std::max(ackedByPeer, Get32(buf + 7));
+        peerAdvantage = int8_t(buf[11]);
+
+        uint32_t hashFrame = Get32(buf + 12);
+        uint64_t hash = uint64_t(Get32(buf + 16)) | (uint64_t(Get32(buf + 20)) << 32);
+        if (hashFrame != UINT32_MAX && (peerHashes.empty() || hashFrame > peerHashes.back().frame)) {
+            peerHashes.push_back({ hashFrame, hash });
+            if (peerHashes.size() > 16) peerHashes.pop_front();
+        }
+
+        // inputs come from the peer's oldest unconfirmed one on, so the next
+        // missing frame is always in there unless the packet is stale
+        uint32_t first = Get32(buf + 24);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t f = first + i;
+            if (f != remoteCount) continue;
+            if (f >= frame + NETPLAY_INPUT_RING - NETPLAY_SNAPSHOTS) break; // would overwrite what a rollback needs
+
+            uint8_t value = buf[NETPLAY_HEADER + i];
+            remoteInput[f % NETPLAY_INPUT_RING] = value;
+            if (f < frame && usedRemote[f % NETPLAY_INPUT_RING] != value) firstWrong = std::min(firstWrong, f);
+            remoteCount++;
+        }
+    }
+}
+
+// every input the peer hasn't confirmed, known up to frame + inputDelay
+void NetplaySession::Send() {
+    uint32_t known = frame + inputDelay;
+    uint32_t first = std::min(ackedByPeer, known);
+    uint32_t count = std::min<uint32_t>(known - first, NETPLAY_INPUT_RING);
+
+    Packet p;
+    p.data.resize(NETPLAY_HEADER + count);
+    uint8_t* b = p.data.data();
+    b[0] = NETPLAY_MAGIC0;
+    b[1] = NETPLAY_MAGIC1;
+    b[2] = NETPLAY_VERSION;
+    Put32(b + 3, frame);
+    Put32(b + 7, remoteCount);
+    b[11] = uint8_t(int8_t(std::clamp(int(frame) - int(peerFrame), -128, 127)));
+    Put32(b + 12, lastHash.frame);
+    Put32(b + 16, uint32_t(lastHash.hash));
+    Put32(b + 20, uint32_t(lastHash.hash >> 32));
+    Put32(b + 24, first);
+    b[28] = uint8_t(count);
+    for (uint32_t i = 0; i < count; i++) b[NETPLAY_HEADER + i] = localInput[(first + i) % NETPLAY_INPUT_RING];
+
+    if (loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < loss) return;
+    p.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(latencyMs);
+    outbox.push_back(std::move(p));
+}
+
+// sends whatever the simulated latency lets out by now
+void NetplaySession::Flush() {
+    if (sock == -1) return;
+    auto now = std::chrono::steady_clock::now();
+    while (!outbox.empty() && outbox.front().due <= now) {
+        const std::vector<uint8_t>& data = outbox.front().data;
+        sendto(sock, reinterpret_cast<const char*>(data.data()), int(data.size()), 0,
+               reinterpret_cast<const sockaddr*>(peerAddr.data()), socklen_t(peerAddr.size()));
+        outbox.pop_front();
+    }
+}
+
+static void PrintNetplayTestUsage() {
+    std::cerr << "usage: MeowNES --netplay-test rom.nes [options]\n"
+              << "  --frames N      frames each side plays (default 1200)\n"
+              << "  --latency MS    one way latency added to every packet (default 50)\n"
+              << "  --loss PCT      packets dropped (default 5)\n"
+              << "  --delay N       input delay frames (default 1)\n"
+              << "  --port N        first of the two loopback ports (default " << NETPLAY_DEFAULT_PORT << ")\n"
+              << "  --desync-at N   poke player 2's RAM at frame N, to see it caught\n";
+}
+
+int RunNetplayTest(const Console& cart, int argc, char** argv) {
+    uint32_t frames = 1200;
+    int latency = 50;
+    double loss = 0.05;
+    int delay = 1;
+    int port = NETPLAY_DEFAULT_PORT;
+    int64_t desyncAt = -1;
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--frames" && hasValue) frames = uint32_t(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--latency" && hasValue) latency = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--loss" && hasValue) loss = std::clamp(std::atof(argv[++i]) / 100, 0.0, 0.9);
+        else if (arg == "--delay" && hasValue) delay = std::atoi(argv[++i]);
+        else if (arg == "--port" && hasValue) port = std::atoi(argv[++i]);
+        else if (arg == "--desync-at" && hasValue) desyncAt = std::atoi(argv[++i]);
+        else {
+            PrintNetplayTestUsage();
+            return 1;
+        }
+    }
+
+    struct Side {
+        std::unique_ptr<Console> nes = std::make_unique<Console>();
+        NetplaySession session;
+        uint32_t hostFrames = 0;
+    };
+    Side sides[2];
+
+    for (int p = 0; p < 2; p++) {
+        Console& nes = *sides[p].nes;
+        nes.LoadCartridge(cart.rom, cart.ppu.VerticalMirror, nullptr);
+        if (p == 1) nes.apu.SetTimingOnly(true, 0); // a side without an audio device
+        NetplaySession& s = sides[p].session;
+        if (!s.Open(uint16_t(port + p), "127.0.0.1", uint16_t(port + 1 - p), p)) return 1;
+        s.SetInputDelay(delay);
+        s.SetSimulatedLatency(latency);
+        s.SetSimulatedLoss(loss);
+        s.Start(nes);
+    }
+
+    // each side mashes its own pad and paces itself like a frontend would
+    auto play = [&](int p) {
+        Side& side = sides[p];
+        std::mt19937 rng(p + 1), junk(p + 3);
+        uint8_t pad = 0;
+        int16_t samples[4096];
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1 / NES_FPS));
+        auto next = std::chrono::steady_clock::now();
+
+        while (side.session.Frame() < frames) {
+            if (rng() % 20 == 0) pad = uint8_t(rng());
+            // kept up until no rollback can reach back past it any more
+            int64_t f = side.session.Frame();
+            if (p == 1 && desyncAt >= 0 && f >= desyncAt && f <= desyncAt + NETPLAY_MAX_ROLLBACK + 2) {
+                side.nes->cpu.RAM[0x7FF] = 0xA5;
+            }
+            // the frontend writes the keyboard into the pads, the session has to ignore it
+            side.nes->controllers[0].state = uint8_t(junk());
+            side.nes->controllers[1].state = uint8_t(junk());
+            side.session.AdvanceFrame(*side.nes, pad);
+            while (side.nes->apu.ReadSamples(samples, 4096) > 0) {}
+            side.hostFrames++;
+
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+        // keep talking for a moment so the last hashes get across
+        for (int i = 0; i < 30; i++) {
+            side.session.AdvanceFrame(*side.nes, pad);
+            while (side.nes->apu.ReadSamples(samples, 4096) > 0) {}
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    };
+
+    std::thread a(play, 0), b(play, 1);
+    a.join();
+    b.join();
+
+    bool failed = false;
+    for (int p = 0; p < 2; p++) {
+        const NetplayStats& st = sides[p].session.Stats();
+        std::cout << "player " << p + 1 << ": " << sides[p].session.Frame() << " frames in " << sides[p].hostFrames << " host frames, "
+                  << st.rollbacks << " rollbacks (" << st.framesResimulated << " frames, longest " << st.maxRollback
+                  << ", worst " << st.maxResimMs << " ms), " << st.stalls << " stalls, "
+                  << st.hashesChecked << " hashes checked";
+        if (st.desyncFrame >= 0) std::cout << ", DESYNC at frame " << st.desyncFrame;
+        std::cout << "\n";
+        if (st.hashesChecked == 0 || (st.desyncFrame >= 0) != (desyncAt >= 0)) failed = true;
+    }
+    return failed ? 1 : 0;
+}
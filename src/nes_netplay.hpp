@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+class Console;
+
+#define NETPLAY_MAX_ROLLBACK 8   // frames this side may run past the last confirmed remote input
+#define NETPLAY_MAX_DELAY 8
+#define NETPLAY_INPUT_RING 64    // inputs kept per player, covers rollback, delay and packets in flight
+#define NETPLAY_SNAPSHOTS (NETPLAY_MAX_ROLLBACK + 2)
+#define NETPLAY_HASH_INTERVAL 60 // frames between state hash exchanges
+#define NETPLAY_DEFAULT_PORT 7845
+
+struct NetplayStats {
+    uint32_t rollbacks = 0;
+    uint32_t framesResimulated = 0;
+    uint32_t maxRollback = 0;
+    uint32_t stalls = 0;        // host frames spent waiting for the peer
+    uint32_t hashesChecked = 0;
+    int64_t desyncFrame = -1;   // first frame whose state hashes differed
+    double resimMs = 0;         // the last rollback
+    double maxResimMs = 0;
+};
+
+// two player rollback netplay over UDP. every frame runs straight away with
+// the remote pad guessed (it repeats its last known input). when the real
+// input turns up and the guess was wrong, the console goes back to the
+// snapshot taken at the start of that frame and runs everything since again
+// with the right input, headless and timing only, before the next frame
+// runs. every packet carries all of this side's inputs the peer hasn't
+// confirmed yet, so a lost one just costs latency. confirmed states are
+// hashed every NETPLAY_HASH_INTERVAL frames and compared across sides, the
+// parts only live audio keeps left out.
+class NetplaySession {
+public:
+    NetplaySession() : rng(std::random_device{}()) {}
+    ~NetplaySession() { Close(); }
+    NetplaySession(const NetplaySession&) = delete;
+    NetplaySession& operator=(const NetplaySession&) = delete;
+
+    // player 0 or 1 is the pad this side drives
+    bool Open(uint16_t localPort, const std::string& peerHost, uint16_t peerPort, int player);
+    void Close();
+    bool IsOpen() const { return sock != -1; }
+
+    // local input goes in this many frames late, fewer rollbacks for some latency.
+    // set it before Start
+    void SetInputDelay(int frames);
+
+    // bad network on purpose, for testing. applies to what this side sends
+    void SetSimulatedLatency(int ms) { latencyMs = ms; }
+    void SetSimulatedLoss(double fraction) { loss = fraction; }
+
+    // powers the console on, both sides start from there with the same ROM
+    void Start(Console& nes);
+
+    // corrects mispredicted frames, then runs the next one with this side's
+    // pad. false when this side is too far ahead of the peer and nothing ran.
+    // rollbacks add no sound for the frames they run again and keep what the
+    // APU already has
+    bool AdvanceFrame(Console& nes, uint8_t pad);
+
+    uint32_t Frame() const { return frame; }
+    uint32_t ConfirmedFrames() const { return remoteCount; }
+    bool PeerSeen() const { return peerSeen; }
+    int Player() const { return player; }
+    const NetplayStats& Stats() const { return stats; }
+
+private:
+    struct StateHash {
+        uint32_t frame;
+        uint64_t hash;
+    };
+
+    struct Packet {
+        std::chrono::steady_clock::time_point due;
+        std::vector<uint8_t> data;
+    };
+
+    intptr_t sock = -1;
+    std::vector<uint8_t> peerAddr; // a sockaddr_in
+    int player = 0;
+    int inputDelay = 2;
+
+    uint32_t frame = 0;        // the next frame to run
+    uint32_t remoteCount = 0;  // remote inputs confirmed, frames [0, remoteCount)
+    uint32_t ackedByPeer = 0;  // local inputs the peer has confirmed
+    uint32_t firstWrong = UINT32_MAX; // earliest frame that ran on a wrong guess
+    uint32_t peerFrame = 0;
+    int peerAdvantage = 0;
+    bool peerSeen = false;
+    uint32_t yieldedAt = UINT32_MAX; // last frame given up for time sync
+
+    uint8_t localInput[NETPLAY_INPUT_RING] = {};
+    uint8_t remoteInput[NETPLAY_INPUT_RING] = {}; // confirmed
+    uint8_t usedRemote[NETPLAY_INPUT_RING] = {};  // what the frame actually ran with
+    std::vector<uint8_t> snapshots[NETPLAY_SNAPSHOTS]; // state at the start of each frame
+
+    uint32_t nextHashFrame = 0;
+    StateHash lastHash = { UINT32_MAX, 0 }; // newest confirmed, goes out with every packet
+    std::deque<StateHash> localHashes, peerHashes;
+
+    int latencyMs = 0;
+    double loss = 0;
+    std::mt19937 rng;
+    std::deque<Packet> outbox;
+
+    NetplayStats stats;
+
+    uint8_t RemoteFor(uint32_t f) const;
+    void RunFrame(Console& nes, uint32_t f);
+    void Rollback(Console& nes);
+    void HashConfirmed();
+    void CompareHashes();
+    void Receive();
+    void Send();
+    void Flush();
+};
+
+// `MeowNES --netplay-test rom.nes ...`: two sessions on loopback UDP in one
+// process, each on its own console and thread with random input, under
+// simulated latency and loss. reports rollbacks and whether the hashes agreed
+int RunNetplayTest(const Console& cart, int argc, char** argv);
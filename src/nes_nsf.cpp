@@ -0,0 +1,281 @@
+#include "nes_nsf.hpp"
+#include "nes_console.hpp"
+#include "nes_archive.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+
+#define NSF_MAX_INIT_CYCLES (CPU_CLOCK_NTSC * 2) // INIT that doesn't come back in 2 s never will
+#define NSF_APU_FRAME 29780                      // longest stretch between blip frames
+
+static uint16_t Read16(const uint8_t* p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
+
+static std::string ReadString(const uint8_t* p, size_t max) {
+    size_t n = 0;
+    while (n < max && p[n]) n++;
+    return std::string(reinterpret_cast<const char*>(p), n);
+}
+
+bool LoadNSF(const std::string& path, NSFImage& nsf) {
+    std::vector<uint8_t> file;
+    if (!ReadROMFile(path, file)) {
+        return false;
+    }
+    if (file.size() <= NSF_HEADER_SIZE || std::memcmp(file.data(), "NESM\x1A", 5) != 0) {
+        std::cerr << "Invalid NSF header: " << path << "\n";
+        return false;
+    }
+
+    const uint8_t* h = file.data();
+    nsf.songs = h[0x06];
+    nsf.startSong = h[0x07] ? h[0x07] : 1;
+    nsf.loadAddr = Read16(h + 0x08);
+    nsf.initAddr = Read16(h + 0x0A);
+    nsf.playAddr = Read16(h + 0x0C);
+    nsf.name = ReadString(h + 0x0E, 32);
+    nsf.artist = ReadString(h + 0x2E, 32);
+    nsf.copyright = ReadString(h + 0x4E, 32);
+    nsf.speed = Read16(h + 0x6E) ? Read16(h + 0x6E) : NSF_DEFAULT_SPEED;
+    std::memcpy(nsf.banks, h + 0x70, 8);
+
+    nsf.bankswitched = false;
+    for (int i = 0; i < 8; i++) {
+        if (nsf.banks[i]) nsf.bankswitched = true;
+    }
+
+    if (h[0x7B] != 0) {
+        std::cerr << "Warning: " << path << " uses expansion audio, only the 2A03 is played\n";
+    }
+    if (nsf.songs == 0 || nsf.loadAddr < 0x8000) {
+        std::cerr << "Unsupported NSF (no songs or load below $8000): " << path << "\n";
+        return false;
+    }
+
+    const uint8_t* body = file.data() + NSF_HEADER_SIZE;
+    size_t size = file.size() - NSF_HEADER_SIZE;
+
+    if (nsf.bankswitched) {
+        size_t pad = nsf.loadAddr & 0x0FFF;
+        size_t total = (pad + size + 0x0FFF) & ~size_t(0x0FFF);
+        nsf.data.assign(total, 0);
+        std::memcpy(nsf.data.data() + pad, body, size);
+    } else {
+        size = std::min(size, size_t(0x10000 - nsf.loadAddr));
+        nsf.data.assign(body, body + size);
+    }
+    return true;
+}
+
+bool NSFPlayer::Start(int song) {
+    CPU& cpu = nes.cpu;
+
+    // a plain image goes where it loads, a bankswitched one is the bank
+    // list as is. $6000-$7FFF is always RAM
+    std::vector<uint8_t> prg;
+    if (nsf.bankswitched) {
+        prg = nsf.data;
+    } else {
+        prg.assign(0x8000, 0);
+        std::memcpy(&prg[nsf.loadAddr - 0x8000], nsf.data.data(), nsf.data.size());
+    }
+    nes.LoadCartridge(MakeROMImage(std::move(prg), {}), false, nullptr);
+    nes.nsf = &nsf;
+    if (nsf.bankswitched) {
+        for (int i = 0; i < 8; i++) nes.MapPRG(i, nsf.banks[i]);
+    }
+
+    // the init sequence every player does before INIT
+    for (uint16_t addr = 0x4000; addr <= 0x4013; addr++) cpu.write(addr, 0);
+    cpu.write(0x4015, 0x0F);
+    cpu.write(0x4017, 0x40);
+
+    cpu.Call(nsf.initAddr, NSF_IDLE_ADDR, uint8_t(song), 0); // x = 0, ntsc
+    uint64_t limit = cpu.TotalCycles + NSF_MAX_INIT_CYCLES;
+    while (cpu.ProgramCounter() != NSF_IDLE_ADDR) {
+        if (cpu.Halted || cpu.TotalCycles > limit) return false;
+        cpu.Step();
+    }
+
+    periodCycles = nsf.speed * (CPU_CLOCK_NTSC / 1e6);
+    nextPlay = double(cpu.TotalCycles);
+    return true;
+}
+
+void NSFPlayer::RunUntil(uint64_t end) {
+    CPU& cpu = nes.cpu;
+    APU& apu = nes.apu;
+    uint64_t frameStart = cpu.TotalCycles;
+
+    while (cpu.TotalCycles < end && !cpu.Halted) {
+        if (cpu.TotalCycles - frameStart >= NSF_APU_FRAME) {
+            apu.EndFrame(cpu.TotalCycles);
+            frameStart = cpu.TotalCycles;
+        }
+
+        // parked: nothing happens until the APU wants something or PLAY is due
+        if (cpu.ProgramCounter() == NSF_IDLE_ADDR && !apu.IRQ()) {
+            uint64_t to = std::min({ end, apu.NextEvent(), frameStart + NSF_APU_FRAME });
+            if (to > cpu.TotalCycles) {
+                cpu.TotalCycles = to;
+                continue;
+            }
+        }
+        cpu.Step();
+    }
+    apu.EndFrame(cpu.TotalCycles);
+}
+
+void NSFPlayer::RunPeriod() {
+    CPU& cpu = nes.cpu;
+
+    // a PLAY that runs long just skips a beat, like on hardware
+    if (cpu.ProgramCounter() == NSF_IDLE_ADDR) {
+        cpu.Call(nsf.playAddr, NSF_IDLE_ADDR, 0, 0);
+    }
+    nextPlay += periodCycles;
+    RunUntil(uint64_t(nextPlay));
+}
+
+static void Put16(std::ofstream& f, uint16_t v) {
+    uint8_t b[2] = { uint8_t(v), uint8_t(v >> 8) };
+    f.write(reinterpret_cast<char*>(b), 2);
+}
+
+static void Put32(std::ofstream& f, uint32_t v) {
+    uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) };
+    f.write(reinterpret_cast<char*>(b), 4);
+}
+
+static bool WriteWAV(const std::string& path, const std::vector<int16_t>& pcm, int rate) {
+    std::ofstream f(path, std::ios::binary);
+    if (!f) {
+        std::cerr << "Can't write " << path << "\n";
+        return false;
+    }
+
+    uint32_t bytes = uint32_t(pcm.size() * 2);
+    f.write("RIFF", 4); Put32(f, 36 + bytes); f.write("WAVE", 4);
+    f.write("fmt ", 4); Put32(f, 16);
+    Put16(f, 1); Put16(f, 1);                   // pcm, mono
+    Put32(f, uint32_t(rate)); Put32(f, uint32_t(rate) * 2);
+    Put16(f, 2); Put16(f, 16);
+    f.write("data", 4); Put32(f, bytes);
+    for (int16_t s : pcm) Put16(f, uint16_t(s));
+    return bool(f);
+}
+
+bool RenderNSFTrack(const NSFImage& nsf, int song, double seconds, int rate, const std::string& wavPath) {
+    // consoles are big, keep them off the worker stacks
+    auto nes = std::make_unique<Console>();
+    nes->apu.SetSampleRate(rate);
+
+    NSFPlayer player(*nes, nsf);
+    if (!player.Start(song)) {
+        std::cerr << nsf.name << " track " << song + 1 << ": INIT didn't return\n";
+        return false;
+    }
+
+    size_t total = size_t(seconds * rate);
+    std::vector<int16_t> pcm;
+    pcm.reserve(total + 4096);
+    int16_t buf[4096];
+
+    while (pcm.size() < total) {
+        player.RunPeriod();
+        if (nes->cpu.Halted) {
+            std::cerr << nsf.name << " track " << song + 1 << ": CPU halted\n";
+            return false;
+        }
+        size_t n;
+        while ((n = nes->apu.ReadSamples(buf, 4096)) > 0) pcm.insert(pcm.end(), buf, buf + n);
+    }
+    pcm.resize(total);
+    return WriteWAV(wavPath, pcm, rate);
+}
+
+static void PrintUsage() {
+    std::cerr << "usage: MeowNES --nsf-render [options] file.nsf...\n"
+              << "  --out DIR      where the WAVs go (default .)\n"
+              << "  --seconds N    length of every track (default 120)\n"
+              << "  --rate HZ      sample rate (default 48000)\n"
+              << "  --track N      only track N (1-based)\n"
+              << "  --jobs N       worker threads (default: all cores)\n";
+}
+
+int RunNSFRender(int argc, char** argv) {
+    std::string outDir = ".";
+    double seconds = 120;
+    int rate = 48000;
+    int onlyTrack = 0;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> files;
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--out" && hasValue) outDir = argv[++i];
+        else if (arg == "--seconds" && hasValue) seconds = std::atof(argv[++i]);
+        else if (arg == "--rate" && hasValue) rate = std::atoi(argv[++i]);
+        else if (arg == "--track" && hasValue) onlyTrack = std::atoi(argv[++i]);
+        else if (arg == "--jobs" && hasValue) jobs = unsigned(std::max(1, std::atoi(argv[++i])));
+        else if (arg.rfind("--", 0) == 0) {
+            PrintUsage();
+            return 1;
+        } else files.push_back(arg);
+    }
+    if (files.empty() || seconds <= 0 || rate <= 0) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<NSFImage> images(files.size());
+    struct Job { size_t image; int song; std::string wav; };
+    std::vector<Job> work;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!LoadNSF(files[i], images[i])) continue;
+        std::string stem = std::filesystem::path(files[i]).stem().string();
+        for (int s = 0; s < images[i].songs; s++) {
+            if (onlyTrack && s + 1 != onlyTrack) continue;
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "-%02d.wav", s + 1);
+            work.push_back({ i, s, (std::filesystem::path(outDir) / (stem + suffix)).string() });
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+
+    // one console per track, workers just pull the next job
+    std::atomic<size_t> next{0};
+    std::atomic<int> failed{0};
+    std::mutex logMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        for (size_t j; (j = next.fetch_add(1)) < work.size();) {
+            bool ok = RenderNSFTrack(images[work[j].image], work[j].song, seconds, rate, work[j].wav);
+            if (!ok) failed++;
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::cout << (ok ? "wrote " : "FAILED ") << work[j].wav << "\n";
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < std::min<size_t>(jobs, work.size()); t++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << work.size() << " tracks in " << elapsed << " s, "
+              << (elapsed > 0 ? work.size() * seconds / elapsed : 0) << "x real time on " << pool.size() << " threads\n";
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Console;
+
+#define NSF_HEADER_SIZE 0x80
+#define NSF_IDLE_ADDR   0x5FF0 // "jmp *" the player parks the CPU on between calls
+#define NSF_DEFAULT_SPEED 16639 // us between PLAY calls, ntsc vblank
+
+// what the CPU reads at NSF_IDLE_ADDR while an NSF is loaded
+inline const uint8_t NSFIdleLoop[3] = { 0x4C, NSF_IDLE_ADDR & 0xFF, NSF_IDLE_ADDR >> 8 };
+
+struct NSFImage {
+    std::string name, artist, copyright;
+    uint8_t songs = 0;
+    uint8_t startSong = 1; // 1-based, like the header
+    uint16_t loadAddr = 0;
+    uint16_t initAddr = 0;
+    uint16_t playAddr = 0;
+    uint16_t speed = NSF_DEFAULT_SPEED;
+    uint8_t banks[8] = {};
+    bool bankswitched = false;
+
+    // bankswitched: whole 4KB banks, the first padded by loadAddr & $FFF.
+    // otherwise the plain image that goes at loadAddr
+    std::vector<uint8_t> data;
+};
+
+bool LoadNSF(const std::string& path, NSFImage& nsf);
+
+// drives a console the way a hardware NSF player does: INIT once, then PLAY
+// every `speed` microseconds. nothing is rendered, and the CPU skips ahead
+// while it is parked between calls
+class NSFPlayer {
+public:
+    NSFPlayer(Console& nes, const NSFImage& nsf) : nes(nes), nsf(nsf) {}
+
+    bool Start(int song); // 0-based
+    void RunPeriod();     // up to the next PLAY call
+
+private:
+    Console& nes;
+    const NSFImage& nsf;
+    double periodCycles = 0;
+    double nextPlay = 0;
+
+    void RunUntil(uint64_t end);
+};
+
+// renders one track to a 16 bit mono WAV
+bool RenderNSFTrack(const NSFImage& nsf, int song, double seconds, int rate, const std::string& wavPath);
+
+// `MeowNES --nsf-render ...`, renders every track of the given files on a thread pool
+int RunNSFRender(int argc, char** argv);
@@ -0,0 +1,111 @@
+#include "nes_obs.hpp"
+#include "nes_ppu.hpp"
+#include "nes.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define OBS_X86
+#include <emmintrin.h>
+#endif
+
+// rec. 601 luma of each NTSC palette entry
+static const uint8_t* LumaTable() {
+    static const auto table = [] {
+        struct { uint8_t v[64]; } t;
+        for (int i = 0; i < 64; i++) {
+            uint32_t c = nesPaletteNTSC[i];
+            double y = 0.299 * ((c >> 16) & 0xFF) + 0.587 * ((c >> 8) & 0xFF) + 0.114 * (c & 0xFF);
+            t.v[i] = uint8_t(std::lround(y));
+        }
+        return t;
+    }();
+    return table.v;
+}
+
+void ObsScaler::Setup(int w, int h, ObsFormat f) {
+    width = std::clamp(w, 1, NES_WIDTH);
+    height = std::clamp(h, 1, NES_HEIGHT);
+    format = f;
+
+    int colStart = 0;
+    for (int x = 0; x < NES_WIDTH; x++) {
+        colCell[x] = uint8_t(x * width / NES_WIDTH);
+        if (x + 1 == NES_WIDTH || (x + 1) * width / NES_WIDTH != colCell[x]) {
+            colScale[colCell[x]] = 1.0f / float(x + 1 - colStart);
+            colSample[colCell[x]] = uint8_t((colStart + x) / 2);
+            colStart = x + 1;
+        }
+    }
+    int rowStart = 0;
+    for (int y = 0; y < NES_HEIGHT; y++) {
+        rowCell[y] = uint8_t(y * height / NES_HEIGHT);
+        if (y + 1 == NES_HEIGHT || (y + 1) * height / NES_HEIGHT != rowCell[y]) {
+            rowScale[rowCell[y]] = 1.0f / float(y + 1 - rowStart);
+            rowSample[rowCell[y]] = uint8_t((rowStart + y) / 2);
+            rowStart = y + 1;
+        }
+    }
+}
+
+// out[c] = sum[c] * colScale[c] * rowScale, rounded to nearest even like cvtps2dq
+static void AverageRow(const uint32_t* sum, const float* colScale, float rowScale, uint8_t* out, int width) {
+    int c = 0;
+#ifdef OBS_X86
+    __m128 rs = _mm_set1_ps(rowScale);
+    for (; c + 8 <= width; c += 8) {
+        __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + c)));
+        __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + c + 4)));
+        a = _mm_mul_ps(_mm_mul_ps(a, _mm_loadu_ps(colScale + c)), rs);
+        b = _mm_mul_ps(_mm_mul_ps(b, _mm_loadu_ps(colScale + c + 4)), rs);
+        __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + c), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; c < width; c++) {
+        out[c] = uint8_t(std::nearbyint(float(sum[c]) * colScale[c] * rowScale));
+    }
+}
+
+void ObsScaler::Render(PPU& ppu, uint8_t* out) const {
+    uint8_t line[NES_WIDTH];
+
+    if (format == ObsFormat::Index) {
+        if (width == NES_WIDTH && height == NES_HEIGHT) {
+            ppu.RenderIndices(out);
+            return;
+        }
+        // only the rows that are sampled get drawn
+        for (int r = 0; r < height; r++) {
+            ppu.RenderLine(rowSample[r], line);
+            for (int c = 0; c < width; c++) out[r * width + c] = line[colSample[c]];
+        }
+        return;
+    }
+
+    const uint8_t* luma = LumaTable();
+    uint32_t sum[NES_WIDTH] = {};
+    for (int y = 0; y < NES_HEIGHT; y++) {
+        ppu.RenderLine(y, line);
+        for (int x = 0; x < NES_WIDTH; x++) sum[colCell[x]] += luma[line[x]];
+
+        int r = rowCell[y];
+        if (y + 1 == NES_HEIGHT || rowCell[y + 1] != r) {
+            AverageRow(sum, colScale, rowScale[r], out + r * width, width);
+            std::fill(sum, sum + width, 0);
+        }
+    }
+}
+
+void MaxPool(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size) {
+    size_t i = 0;
+#ifdef OBS_X86
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_max_epu8(x, y));
+    }
+#endif
+    for (; i < size; i++) out[i] = std::max(a[i], b[i]);
+}
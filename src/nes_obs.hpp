@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+class PPU;
+
+enum class ObsFormat : uint8_t {
+    Grey,  // luma of the NTSC palette, area averaged
+    Index, // NES colour index (0-63), the pixel nearest each cell's centre
+};
+
+// a small observation of the picture for agents, width x height bytes. made
+// after the frame, a line at a time from the PPU's registers as they stand
+// at its end, so the full size frame is never built. scroll splits made
+// mid-frame don't show, the whole picture uses the final scroll. only
+// scales down: 1-256 wide, 1-240 high
+class ObsScaler {
+public:
+    ObsScaler() { Setup(84, 84, ObsFormat::Grey); }
+
+    void Setup(int width, int height, ObsFormat format);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    size_t Size() const { return size_t(width) * height; }
+
+    void Render(PPU& ppu, uint8_t* out) const;
+
+private:
+    int width = 0, height = 0;
+    ObsFormat format = ObsFormat::Grey;
+
+    // every source column and row falls in exactly one cell
+    uint8_t colCell[256];
+    uint8_t rowCell[240];
+    uint8_t colSample[256]; // Index: the source column (row) each cell takes
+    uint8_t rowSample[240];
+    float colScale[256];    // Grey: 1 / (columns in the cell)
+    float rowScale[240];
+};
+
+// out = max(a, b) bytewise, for pooling the last two grey frames against
+// flicker. meaningless on palette indices
+void MaxPool(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size);
@@ -1,15 +1,27 @@
 #include "nes_ppu.hpp"
-#include "nes_cpu.hpp"
+#include "nes_console.hpp"
+#include "nes.hpp"
 #include <cstring>
 
-PPU ppu;
+Console& PPU::Nes() {
+    return Console::Of(this);
+}
 
-void PPU::Step() {
-    Dot++;
-    if (Dot > 341) {
+// nothing happens mid scanline, so the dots inside one are skipped in one go
+void PPU::Run(uint32_t dots) {
+    for (;;) {
+        uint32_t toNextLine = uint32_t(341 - Dot);
+        if (dots < toNextLine) {
+            Dot += int(dots);
+            return;
+        }
+        dots -= toNextLine;
         Dot = 0;
         ScanLine++;
-        if (ScanLine == 241) Vblank = true;
+        if (ScanLine == 241) {
+            Vblank = true;
+            FrameReady = true;
+        }
         if (ScanLine == 261) Vblank = false;
         if (ScanLine > 261) {
             ScanLine = 0;
@@ -17,11 +29,6 @@ void PPU::Step() {
     }
 }
 
-void PPU::LoadCHRROM(const uint8_t* chrData, int chrSize) {
-    if (chrSize > 0x2000) chrSize = 0x2000;
-    std::memcpy(&ChrROM[0x0000], chrData, chrSize);
-}
-
 SDL_Window* window = nullptr;
 SDL_Texture* texture = nullptr;
 
@@ -61,60 +68,51 @@ const uint32_t nesPalettePAL[64] = {
 };
 
 
-void PPU::Render(SDL_Renderer* renderer) {
-    uint32_t pixels[NES_WIDTH * NES_HEIGHT];
+void PPU::RenderLine(int y, uint8_t* line) {
     uint8_t palOffset = 4;
+    const uint8_t* ChrROM = Nes().chr;
 
     if (UseRandPalIndex)
         palOffset = RanPalIndex;
 
-    uint32_t nesPalette[64] = {0};
-    const uint32_t* activePalette = (PaletteMode == 0) ? nesPaletteNTSC : nesPalettePAL;
-    memcpy(nesPalette, activePalette, sizeof(nesPalette));
-
-    if (PaletteMode == 1) {
-        for (int i = 0; i < 64; i++) {
-            uint8_t r = (nesPalette[i] >> 16) & 0xFF;
-            uint8_t g = (nesPalette[i] >> 8) & 0xFF;
-            uint8_t b = (nesPalette[i] >> 0) & 0xFF;
-            r = static_cast<uint8_t>(r * 0.95f);
-            g = static_cast<uint8_t>(g * 0.95f);
-            b = static_cast<uint8_t>(b * 0.98f);
-            nesPalette[i] = (r << 16) | (g << 8) | b;
-        }
-    }
-
-    for (int screenY = 0; screenY < NES_HEIGHT; screenY++) {
-        for (int screenX = 0; screenX < NES_WIDTH; screenX++) {
-            int scrolledX = (screenX + scrollX) % 256;
-            int scrolledY = (screenY + scrollY) % 240;
-            int tileX = scrolledX / 8;
-            int tileY = scrolledY / 8;
-            int fineX = scrolledX % 8;
-            int fineY = scrolledY % 8;
-
-            uint8_t tileIndex = VRAM[tileY * 32 + tileX];
-
-            int useSecond = BGPatternTable ? 0x1000 : 0x0000;
-            uint8_t lo = ChrROM[tileIndex * 16 + fineY + useSecond];
-            uint8_t hi = ChrROM[tileIndex * 16 + fineY + 8 + useSecond];
-
-            uint8_t attrOffset = (tileX / 4) + (tileY / 4) * 8;
-            uint8_t attributes = VRAM[0x3C0 + attrOffset];
-            uint8_t quadrant = ((tileX / 2) & 1) + (((tileY / 2) & 1) * 2);
-            uint8_t pair = (attributes >> (quadrant * 2)) & 3;
-
+    // background, a tile (8 pixels, one pattern row and attribute) at a time
+    int scrolledY = (y + scrollY) % 240;
+    int tileY = scrolledY / 8;
+    int fineY = scrolledY % 8;
+    int useSecond = BGPatternTable ? 0x1000 : 0x0000;
+
+    for (int screenX = 0; screenX < NES_WIDTH;) {
+        int scrolledX = (screenX + scrollX) % 256;
+        int tileX = scrolledX / 8;
+        int fineX = scrolledX % 8;
+
+        uint8_t tileIndex = VRAM[tileY * 32 + tileX];
+        uint8_t lo = ChrROM[tileIndex * 16 + fineY + useSecond];
+        uint8_t hi = ChrROM[tileIndex * 16 + fineY + 8 + useSecond];
+
+        uint8_t attrOffset = (tileX / 4) + (tileY / 4) * 8;
+        uint8_t attributes = VRAM[0x3C0 + attrOffset];
+        uint8_t quadrant = ((tileX / 2) & 1) + (((tileY / 2) & 1) * 2);
+        uint8_t pair = (attributes >> (quadrant * 2)) & 3;
+        const uint8_t colors[4] = {
+            uint8_t(paletteRAM[0] & 0x3F),
+            uint8_t(paletteRAM[1 + pair * palOffset] & 0x3F),
+            uint8_t(paletteRAM[2 + pair * palOffset] & 0x3F),
+            uint8_t(paletteRAM[3 + pair * palOffset] & 0x3F),
+        };
+
+        for (; fineX < 8 && screenX < NES_WIDTH; fineX++, screenX++) {
             int bit = 7 - fineX;
-            int twoBit = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
-            uint8_t palIndex = twoBit ? paletteRAM[twoBit + pair * palOffset] : paletteRAM[0];
-            uint32_t color = nesPalette[palIndex & 0x3F];
-
-            pixels[screenY * NES_WIDTH + screenX] = color;
+            line[screenX] = colors[((hi >> bit) & 1) << 1 | ((lo >> bit) & 1)];
         }
     }
 
+    // sprites in OAM order, a later one covers an earlier one
     for (int i = 0; i < 64; i++) {
         int spriteY = OAM[i * 4 + 0] + 1;
+        int row = y - spriteY;
+        if (row < 0 || row >= 8) continue;
+
         int tile = OAM[i * 4 + 1];
         int attr = OAM[i * 4 + 2];
         int spriteX = OAM[i * 4 + 3];
@@ -125,27 +123,51 @@ void PPU::Render(SDL_Renderer* renderer) {
         uint16_t spriteTable = spritePatternTable ? 0x1000 : 0x0000;
         const uint8_t* tileData = &ChrROM[spriteTable + tile * 16];
 
-        for (int row = 0; row < 8; row++) {
-            int tileRow = flipV ? 7 - row : row;
-            uint8_t plane0 = tileData[tileRow];
-            uint8_t plane1 = tileData[tileRow + 8];
-
-            for (int col = 0; col < 8; col++) {
-                int tileCol = flipH ? 7 - col : col;
-                uint8_t colorLow  = (plane0 >> (7 - tileCol)) & 1;
-                uint8_t colorHigh = (plane1 >> (7 - tileCol)) & 1;
-                uint8_t colorId = (colorHigh << 1) | colorLow;
-                if (colorId == 0) continue;
-
-                int px = spriteX + col;
-                int py = spriteY + row;
-                if (px < 0 || px >= NES_WIDTH || py < 0 || py >= NES_HEIGHT) continue;
-
-                uint8_t palEntry = paletteRAM[(palOffset * 4) + (paletteIndex * 4) + colorId] & 0x3F;
-                pixels[py * NES_WIDTH + px] = nesPalette[palEntry];
-            }
+        int tileRow = flipV ? 7 - row : row;
+        uint8_t plane0 = tileData[tileRow];
+        uint8_t plane1 = tileData[tileRow + 8];
+
+        for (int col = 0; col < 8; col++) {
+            int tileCol = flipH ? 7 - col : col;
+            uint8_t colorLow  = (plane0 >> (7 - tileCol)) & 1;
+            uint8_t colorHigh = (plane1 >> (7 - tileCol)) & 1;
+            uint8_t colorId = (colorHigh << 1) | colorLow;
+            if (colorId == 0) continue;
+
+            int px = spriteX + col;
+            if (px >= NES_WIDTH) continue;
+
+            line[px] = paletteRAM[(palOffset * 4) + (paletteIndex * 4) + colorId] & 0x3F;
         }
     }
+}
+
+void PPU::RenderIndices(uint8_t* out) {
+    for (int y = 0; y < NES_HEIGHT; y++) RenderLine(y, out + y * NES_WIDTH);
+}
+
+void PPU::Render(SDL_Renderer* renderer) {
+    uint8_t indices[NES_WIDTH * NES_HEIGHT];
+    uint32_t pixels[NES_WIDTH * NES_HEIGHT];
+    RenderIndices(indices);
+
+    uint32_t nesPalette[64] = {0};
+    const uint32_t* activePalette = (PaletteMode == 0) ? nesPaletteNTSC : nesPalettePAL;
+    memcpy(nesPalette, activePalette, sizeof(nesPalette));
+
+    if (PaletteMode == 1) {
+        for (int i = 0; i < 64; i++) {
+            uint8_t r = (nesPalette[i] >> 16) & 0xFF;
+            uint8_t g = (nesPalette[i] >> 8) & 0xFF;
+            uint8_t b = (nesPalette[i] >> 0) & 0xFF;
+            r = static_cast<uint8_t>(r * 0.95f);
+            g = static_cast<uint8_t>(g * 0.95f);
+            b = static_cast<uint8_t>(b * 0.98f);
+            nesPalette[i] = (r << 16) | (g << 8) | b;
+        }
+    }
+
+    for (int i = 0; i < NES_WIDTH * NES_HEIGHT; i++) pixels[i] = nesPalette[indices[i]];
 
     SDL_UpdateTexture(texture, nullptr, pixels, NES_WIDTH * sizeof(uint32_t));
     SDL_RenderClear(renderer);
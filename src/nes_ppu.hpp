@@ -5,13 +5,30 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+class Console;
+
+// 0x00RRGGBB per NES colour index
+extern const uint32_t nesPaletteNTSC[64];
+
+// console state like the CPU: plain data, pattern tables are reached through
+// Nes() since they belong to the cartridge
 class PPU {
 public:
-    std::array<uint8_t, 0x4000> ChrROM{};
-    std::array<uint8_t, 0x4000> VRAM{};
+    Console& Nes();
+
+    std::array<uint8_t, 0x800> VRAM{}; // the 2KB of nametable RAM
     std::array<uint8_t, 0x20> paletteRAM{};
     std::array<uint8_t, 256> OAM{};
 
+    bool VerticalMirror = false; // from the iNES header
+    bool ChrIsRAM = false;       // no CHR ROM, pattern tables are writable
+
+    // $2000-$2FFF offset to VRAM index
+    uint16_t MirrorNametable(uint16_t nt) const {
+        if (VerticalMirror) return nt & 0x7FF;
+        return (nt & 0x3FF) | ((nt & 0x800) >> 1);
+    }
+
     bool WriteLatch = false;
     unsigned short TransferAddr = 0;
     unsigned short VRAMAddr = 0;
@@ -21,6 +38,7 @@ public:
     int Dot = 0;
     int ScanLine = 0;
     bool Vblank = false;
+    bool FrameReady = false; // set when vblank starts
 
     bool mask8pxMaskBG = false;
     bool mask8pxMaskSprites = false;
@@ -38,17 +56,23 @@ public:
     uint16_t scrollY = 0;  // vertical scroll in pixels
     uint8_t scrollFineX = 0; // 0-7, fine pixel shift inside a tile
 
-    int PaletteMode = 0;
-    bool UseRandPalIndex = false;
-    uint8_t RanPalIndex = 4;
-
-    void Step();
+    // display settings, shared by every console and not part of the state
+    static inline int PaletteMode = 0;
+    static inline bool UseRandPalIndex = false;
+    static inline uint8_t RanPalIndex = 4;
 
-    void LoadCHRROM(const uint8_t* chrData, int chrSize);
+    // timing only: vblank, NMI and the status bits follow the dot counter,
+    // pixels only come from Render
+    void Run(uint32_t dots);
 
     bool InitSDL(SDL_Renderer * renderer);
     void ShutdownSDL();
     void Render(SDL_Renderer * renderer);
-};
 
-extern PPU ppu;
\ No newline at end of file
+    // the picture as NES colour indices (0-63), NES_WIDTH x NES_HEIGHT. what
+    // Render shows, without SDL or a palette
+    void RenderIndices(uint8_t* out);
+
+    // one scanline of that, NES_WIDTH indices
+    void RenderLine(int y, uint8_t* line);
+};
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "nes_rewind.hpp"
+#include "nes_console.hpp"
+
+#include <cstring>
+
+static uint64_t Load64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static uint8_t* PutVarint(uint8_t* p, size_t v) {
+    while (v >= 0x80) {
+        *p++ = uint8_t(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = uint8_t(v);
+    return p;
+}
+
+static size_t GetVarint(const uint8_t*& p) {
+    size_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = *p++;
+        v |= size_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+// (zero run, literal run, literal bytes) of a ^ b. a literal run only ends at
+// two equal bytes in a row, so the output can't grow past n plus a few bytes
+static size_t EncodeDelta(const uint8_t* a, const uint8_t* b, size_t n, uint8_t* out) {
+    uint8_t* p = out;
+    size_t i = 0;
+    while (i < n) {
+        size_t z = i;
+        while (z + 8 <= n && Load64(a + z) == Load64(b + z)) z += 8;
+        while (z < n && a[z] == b[z]) z++;
+
+        size_t l = z;
+        while (l < n && !(a[l] == b[l] && (l + 1 == n || a[l + 1] == b[l + 1]))) l++;
+
+        p = PutVarint(p, z - i);
+        p = PutVarint(p, l - z);
+        for (size_t k = z; k < l; k++) *p++ = a[k] ^ b[k];
+        i = l;
+    }
+    return size_t(p - out);
+}
+
+static void ApplyDelta(const uint8_t* in, size_t size, uint8_t* state) {
+    const uint8_t* end = in + size;
+    size_t i = 0;
+    while (in < end) {
+        i += GetVarint(in);
+        size_t count = GetVarint(in);
+        for (size_t k = 0; k < count; k++) state[i++] ^= *in++;
+    }
+}
+
+void RewindBuffer::SetBudget(size_t bytes) {
+    budget = bytes;
+    ring.reset();
+    Clear();
+}
+
+void RewindBuffer::Clear() {
+    entries.clear();
+    head = used = 0;
+    last.clear();
+}
+
+void RewindBuffer::Push(const Console& nes) {
+    size_t size = nes.StateSize();
+    if (size != last.size()) {
+        // first frame, or another cartridge: nothing to diff against
+        Clear();
+        last.resize(size);
+        nes.saveState(last.data());
+        return;
+    }
+
+    current.resize(size);
+    nes.saveState(current.data());
+    packed.resize(size + size / 2 + 32);
+    Store(packed.data(), EncodeDelta(current.data(), last.data(), size, packed.data()));
+    last.swap(current);
+}
+
+// entries are laid out in push order and wrap at the end of the ring, so the
+// space the next one needs is always taken from the oldest
+void RewindBuffer::Store(const uint8_t* data, size_t size) {
+    if (size > budget) {
+        Clear();
+        return;
+    }
+    if (!ring) ring.reset(new uint8_t[budget]);
+
+    if (head + size > budget) {
+        while (!entries.empty() && entries.front().offset >= head) {
+            used -= entries.front().size;
+            entries.pop_front();
+        }
+        head = 0;
+    }
+    while (!entries.empty() && entries.front().offset < head + size
+           && entries.front().offset + entries.front().size > head) {
+        used -= entries.front().size;
+        entries.pop_front();
+    }
+
+    std::memcpy(&ring[head], data, size);
+    entries.push_back({ head, size });
+    head += size;
+    used += size;
+}
+
+bool RewindBuffer::StepBack(Console& nes) {
+    if (entries.empty() || last.size() != nes.StateSize()) return false;
+
+    Entry e = entries.back();
+    entries.pop_back();
+    used -= e.size;
+    head = e.offset;
+
+    ApplyDelta(&ring[e.offset], e.size, last.data());
+    nes.loadState(last.data());
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class Console;
+
+#define REWIND_DEFAULT_BUDGET (64u << 20) // bytes of encoded history
+
+// every frame's state, kept as the XOR against the frame before it and run
+// length encoded. two neighbouring frames differ in a few hundred bytes at
+// most, so an entry is mostly one long zero run. the newest state is kept
+// whole, and stepping back undoes the newest delta on it, so going back is
+// one decode per frame no matter how far. the oldest frames go when the
+// budget is full.
+class RewindBuffer {
+public:
+    void SetBudget(size_t bytes);
+    void Clear();
+
+    // after every emulated frame
+    void Push(const Console& nes);
+
+    // loads the frame before the newest one and forgets the newest, false
+    // when there's nothing older left
+    bool StepBack(Console& nes);
+
+    size_t Frames() const { return entries.size(); }
+    size_t BytesUsed() const { return used; }
+    size_t Budget() const { return budget; }
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t size;
+    };
+
+    size_t budget = REWIND_DEFAULT_BUDGET;
+    std::unique_ptr<uint8_t[]> ring; // allocated on the first push, pages get touched as it fills
+    size_t head = 0;                 // where the next entry goes
+    size_t used = 0;
+    std::deque<Entry> entries;       // oldest first
+
+    std::vector<uint8_t> last;       // the newest state, whole
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> packed;
+
+    void Store(const uint8_t* data, size_t size);
+};
@@ -0,0 +1,143 @@
+#include "nes_savestate.hpp"
+#include "nes_console.hpp"
+#include "lz_codec.hpp"
+#include "state_hash.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+StateSaver stateSaver;
+
+static void Put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = uint8_t(v >> (i * 8));
+}
+
+static void Put64(uint8_t* p, uint64_t v) {
+    Put32(p, uint32_t(v));
+    Put32(p + 4, uint32_t(v >> 32));
+}
+
+static uint32_t Get32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t Get64(const uint8_t* p) {
+    return uint64_t(Get32(p)) | uint64_t(Get32(p + 4)) << 32;
+}
+
+std::string StatePathForROM(const std::string& romPath, int slot) {
+    return std::filesystem::path(romPath).replace_extension(".ss" + std::to_string(slot)).string();
+}
+
+StateSaver::~StateSaver() {
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void StateSaver::Save(const Console& nes, const std::string& path) {
+    Job job{ path, nes.ROMHash(), std::vector<uint8_t>(nes.StateSize()) };
+    nes.saveState(job.state.data());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!thread.joinable()) thread = std::thread(&StateSaver::WriterLoop, this);
+    queue.push_back(std::move(job));
+    wake.notify_one();
+}
+
+void StateSaver::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return queue.empty() && !busy; });
+}
+
+static bool WriteStateFile(const std::string& path, uint64_t romHash, const std::vector<uint8_t>& state) {
+    std::vector<uint8_t> file(SAVESTATE_HEADER_SIZE);
+    LZCompress(state.data(), state.size(), file);
+
+    uint8_t* h = file.data();
+    std::memcpy(h, "MNST", 4);
+    Put32(h + 4, SAVESTATE_VERSION);
+    Put64(h + 8, romHash);
+    Put32(h + 16, uint32_t(state.size()));
+    Put32(h + 20, uint32_t(file.size() - SAVESTATE_HEADER_SIZE));
+    Put64(h + 24, HashBytes(state.data(), state.size()));
+
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream f(temp, std::ios::binary | std::ios::trunc);
+        f.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+        if (!f.flush()) {
+            std::cerr << "Can't write " << temp << "\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        std::cerr << "Can't replace " << path << ": " << ec.message() << "\n";
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+void StateSaver::WriterLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&] { return closing || !queue.empty(); });
+        while (!queue.empty()) {
+            Job job = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+            WriteStateFile(job.path, job.romHash, job.state);
+            lock.lock();
+            busy = false;
+        }
+        done.notify_all();
+        if (closing) break;
+    }
+}
+
+bool LoadStateFile(Console& nes, const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(f)), {});
+    if (!f.is_open() || file.size() < SAVESTATE_HEADER_SIZE || std::memcmp(file.data(), "MNST", 4) != 0) {
+        std::cerr << "Not a savestate: " << path << "\n";
+        return false;
+    }
+
+    const uint8_t* h = file.data();
+    if (Get32(h + 4) != SAVESTATE_VERSION) {
+        std::cerr << "Savestate from another version (" << Get32(h + 4) << "): " << path << "\n";
+        return false;
+    }
+    if (Get64(h + 8) != nes.ROMHash() || Get32(h + 16) != nes.StateSize()) {
+        std::cerr << "Savestate is of a different game: " << path << "\n";
+        return false;
+    }
+
+    // unpacked aside and checked first, a bad file must not leave the console half loaded
+    static thread_local std::vector<uint8_t> state;
+    state.resize(nes.StateSize());
+    size_t packed = Get32(h + 20);
+    if (packed > file.size() - SAVESTATE_HEADER_SIZE
+        || !LZDecompress(h + SAVESTATE_HEADER_SIZE, packed, state.data(), state.size())
+        || HashBytes(state.data(), state.size()) != Get64(h + 24)) {
+        std::cerr << "Savestate is damaged: " << path << "\n";
+        return false;
+    }
+
+    // whether there's sound is up to the frontend, not the file
+    bool timingOnly = nes.apu.TimingOnly();
+    nes.loadState(state.data());
+    if (nes.apu.TimingOnly() != timingOnly) nes.apu.SetTimingOnly(timingOnly, nes.cpu.TotalCycles);
+    return true;
+}
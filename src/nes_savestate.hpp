@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Console;
+
+#define SAVESTATE_VERSION 2 // goes up whenever ConsoleState changes layout
+#define SAVESTATE_HEADER_SIZE 32
+#define SAVESTATE_SLOTS 9 // numbered from 1
+
+// a savestate file is
+//   "MNST", version (u32), ROM hash (u64), state size (u32), packed size (u32),
+//   hash of the state (u64), then the state as saveState writes it, LZ packed.
+// little endian. the hash catches a damaged file before it gets near the console
+
+// <rom dir>/<rom name>.ss<slot>
+std::string StatePathForROM(const std::string& romPath, int slot);
+
+// saves in the background. the frame that asks only copies the state, the
+// packing and the disk belong to a thread of its own. a file is written
+// under a temporary name and renamed over the old one, so a crash halfway
+// leaves the previous save as it was
+class StateSaver {
+public:
+    ~StateSaver();
+
+    void Save(const Console& nes, const std::string& path);
+
+    // until every save asked for so far is on disk
+    void Wait();
+
+private:
+    struct Job {
+        std::string path;
+        uint64_t romHash;
+        std::vector<uint8_t> state;
+    };
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::deque<Job> queue;
+    bool busy = false;
+    bool closing = false;
+
+    void WriterLoop();
+};
+
+// checks the file belongs to this game and is whole, then unpacks it into
+// the console. the console is left alone when anything is wrong
+bool LoadStateFile(Console& nes, const std::string& path);
+
+extern StateSaver stateSaver;
@@ -0,0 +1,157 @@
+#include "nes_sram.hpp"
+
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+BatteryRAM sram;
+
+std::string SavePathForROM(const std::string& romPath) {
+    return std::filesystem::path(romPath).replace_extension(".sav").string();
+}
+
+#ifndef _WIN32
+
+bool BatteryRAM::Open(const std::string& path, size_t ramSize) {
+    Close();
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open save file: " << path << "\n";
+        return false;
+    }
+
+    // two instances on one .sav would silently trample each other, so the
+    // second one gets a private copy that is never written back
+    shared = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    if (!shared) {
+        std::cerr << "Warning: " << path << " is in use by another instance, saves will not persist\n";
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        Close();
+        return false;
+    }
+
+    // a new (or truncated) save grows with zero fill, existing bytes are kept
+    if (shared && size_t(st.st_size) < ramSize && ftruncate(fd, off_t(ramSize)) != 0) {
+        std::cerr << "Failed to size save file: " << path << "\n";
+        Close();
+        return false;
+    }
+
+    void* p;
+    if (shared) {
+        p = mmap(nullptr, ramSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        p = mmap(nullptr, ramSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            ssize_t got = pread(fd, p, ramSize, 0);
+            (void)got;
+        }
+    }
+    if (p == MAP_FAILED) {
+        std::cerr << "Failed to map save file: " << path << "\n";
+        Close();
+        return false;
+    }
+
+    data = static_cast<uint8_t*>(p);
+    size = ramSize;
+    Dirty = false;
+    return true;
+}
+
+void BatteryRAM::Close() {
+    if (data) {
+        Flush();
+        munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+    if (fd >= 0) {
+        close(fd); // drops the flock too
+        fd = -1;
+    }
+    shared = false;
+}
+
+void BatteryRAM::Flush() {
+    if (!data || !Dirty) return;
+    Dirty = false;
+    if (shared) msync(data, size, MS_ASYNC);
+}
+
+#else
+
+bool BatteryRAM::Open(const std::string& path, size_t ramSize) {
+    Close();
+
+    // no share mode: a second instance can't open the same save at all
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open save file: " << path << "\n";
+        return false;
+    }
+    file = f;
+
+    // CreateFileMapping grows the file to ramSize if it is shorter
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READWRITE, 0, DWORD(ramSize), nullptr);
+    if (!m) {
+        std::cerr << "Failed to map save file: " << path << "\n";
+        Close();
+        return false;
+    }
+    mapping = m;
+
+    void* p = MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, ramSize);
+    if (!p) {
+        std::cerr << "Failed to map save file: " << path << "\n";
+        Close();
+        return false;
+    }
+
+    data = static_cast<uint8_t*>(p);
+    size = ramSize;
+    shared = true;
+    Dirty = false;
+    return true;
+}
+
+void BatteryRAM::Close() {
+    if (data) {
+        Flush();
+        UnmapViewOfFile(data);
+        data = nullptr;
+        size = 0;
+    }
+    if (mapping) {
+        CloseHandle(static_cast<HANDLE>(mapping));
+        mapping = nullptr;
+    }
+    if (file) {
+        CloseHandle(static_cast<HANDLE>(file));
+        file = nullptr;
+    }
+    shared = false;
+}
+
+void BatteryRAM::Flush() {
+    if (!data || !Dirty) return;
+    Dirty = false;
+    FlushViewOfFile(data, size); // queues the writes, doesn't wait for the disk
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define SRAM_SIZE 0x2000
+
+// battery backed PRG-RAM ($6000-$7FFF) living directly in a mmap'd .sav file.
+// the mapping is shared, so every CPU store already sits in the page cache and
+// survives the process crashing; Flush() only asks the kernel to start writeback.
+class BatteryRAM {
+public:
+    ~BatteryRAM() { Close(); }
+
+    bool Open(const std::string& path, size_t size = SRAM_SIZE);
+    void Close();
+    void Flush(); // async, cheap when nothing changed since the last one
+
+    uint8_t* Data() const { return data; }
+    bool IsOpen() const { return data != nullptr; }
+
+    bool Dirty = false;
+
+private:
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    bool shared = false;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// <rom dir>/<rom name>.sav
+std::string SavePathForROM(const std::string& romPath);
+
+extern BatteryRAM sram;
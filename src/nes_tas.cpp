@@ -0,0 +1,307 @@
+#include "nes_tas.hpp"
+#include "nes_console.hpp"
+#include "nes_movie.hpp"
+#include "nes_transposition.hpp"
+#include "worker_pool.hpp"
+#include "nes.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+
+static void PrintTASUsage() {
+    std::cerr << "usage: MeowNES --tas-search rom.nes [options]\n"
+              << "  --until '$0770==1'   goal, the fewest frames until it holds (also != < <= > >=)\n"
+              << "  --maximize '$6D:$86' score to raise, bytes high to low. with --until it\n"
+              << "                       ranks states on the way, alone it's the objective\n"
+              << "  --minimize ADDRS     the same, lower is better\n"
+              << "  --inputs LIST        the alphabet, e.g. right+a,right,a,none\n"
+              << "                       (up down left right a b start select, default none)\n"
+              << "  --hold N             frames each input is held (default 4)\n"
+              << "  --frames N           search at most this many frames (default 600)\n"
+              << "  --beam N             states kept per step (default 256)\n"
+              << "  --movie FILE         start from the end of this movie\n"
+              << "  --out FILE           the best movie found (default tas.mnm)\n"
+              << "  --threads N          0 for one per core (default)\n"
+              << "  --table-mb N         memory for spotting repeated states (default 256)\n";
+}
+
+// $0770, 0x770 or 1904. work RAM and cartridge RAM, what a game keeps score in
+static bool ParseAddress(const std::string& s, uint16_t& addr) {
+    const char* p = s.c_str();
+    int base = 10;
+    if (*p == '$') {
+        p++;
+        base = 16;
+    }
+    char* end = nullptr;
+    unsigned long v = std::strtoul(p, &end, base);
+    if (end == p || *end || v > 0xFFFF || !(v < 0x2000 || (v >= 0x6000 && v < 0x8000))) {
+        std::cerr << "Not a RAM address: " << s << "\n";
+        return false;
+    }
+    addr = uint16_t(v);
+    return true;
+}
+
+static uint8_t ReadRAM(const Console& nes, uint16_t addr) {
+    if (addr < 0x2000) return nes.cpu.RAM[addr & 0x7FF];
+    return nes.prgRAM ? nes.prgRAM[addr - 0x6000] : 0;
+}
+
+struct Condition {
+    uint16_t addr = 0;
+    std::string op;
+    int value = 0;
+};
+
+static bool ParseCondition(const std::string& s, Condition& c) {
+    size_t at = s.find_first_of("=!<>");
+    if (at == std::string::npos) {
+        std::cerr << "Not a condition: " << s << "\n";
+        return false;
+    }
+    size_t len = (at + 1 < s.size() && s[at + 1] == '=') ? 2 : 1;
+    c.op = s.substr(at, len);
+    if (c.op == "=" || c.op == "!") {
+        std::cerr << "Not a condition: " << s << "\n";
+        return false;
+    }
+    c.value = int(std::strtol(s.c_str() + at + len, nullptr, 0));
+    return ParseAddress(s.substr(0, at), c.addr);
+}
+
+static bool Holds(const Condition& c, const Console& nes) {
+    int v = ReadRAM(nes, c.addr);
+    if (c.op == "==") return v == c.value;
+    if (c.op == "!=") return v != c.value;
+    if (c.op == "<") return v < c.value;
+    if (c.op == "<=") return v <= c.value;
+    if (c.op == ">") return v > c.value;
+    return v >= c.value;
+}
+
+static bool ParseAddresses(const std::string& s, std::vector<uint16_t>& addrs) {
+    std::istringstream in(s);
+    std::string part;
+    while (std::getline(in, part, ':')) {
+        uint16_t addr;
+        if (!ParseAddress(part, addr)) return false;
+        addrs.push_back(addr);
+    }
+    return !addrs.empty();
+}
+
+static bool ParseInputs(const std::string& s, std::vector<uint8_t>& alphabet) {
+    static const std::pair<const char*, uint8_t> buttons[] = {
+        {"up", STICK_UP}, {"down", STICK_DOWN}, {"left", STICK_LEFT}, {"right", STICK_RIGHT},
+        {"a", A_BUTTON}, {"b", B_BUTTON}, {"start", START_BUTTON}, {"select", SELECT_BUTTON}, {"none", 0},
+    };
+    std::istringstream in(s);
+    std::string input;
+    while (std::getline(in, input, ',')) {
+        uint8_t pad = 0;
+        std::istringstream parts(input);
+        std::string name;
+        while (std::getline(parts, name, '+')) {
+            auto b = std::find_if(std::begin(buttons), std::end(buttons),
+                                  [&](const auto& b) { return name == b.first; });
+            if (b == std::end(buttons)) {
+                std::cerr << "Unknown button: " << name << "\n";
+                return false;
+            }
+            pad |= b->second;
+        }
+        alphabet.push_back(pad);
+    }
+    return !alphabet.empty();
+}
+
+int RunTASSearch(const Console& cart, int argc, char** argv) {
+    Condition goal;
+    bool hasGoal = false;
+    std::vector<uint16_t> scoreAddrs;
+    bool minimize = false;
+    std::vector<uint8_t> alphabet;
+    long hold = 4, maxFrames = 600, beamWidth = 256;
+    int threads = 0;
+    size_t tableMB = 256;
+    std::string moviePath, out = "tas.mnm";
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = hasValue;
+        if (arg == "--until" && hasValue) ok = hasGoal = ParseCondition(argv[++i], goal);
+        else if (arg == "--maximize" && hasValue) ok = ParseAddresses(argv[++i], scoreAddrs);
+        else if (arg == "--minimize" && hasValue) ok = minimize = ParseAddresses(argv[++i], scoreAddrs);
+        else if (arg == "--inputs" && hasValue) ok = ParseInputs(argv[++i], alphabet);
+        else if (arg == "--hold" && hasValue) hold = std::atol(argv[++i]);
+        else if (arg == "--frames" && hasValue) maxFrames = std::atol(argv[++i]);
+        else if (arg == "--beam" && hasValue) beamWidth = std::atol(argv[++i]);
+        else if (arg == "--movie" && hasValue) moviePath = argv[++i];
+        else if (arg == "--out" && hasValue) out = argv[++i];
+        else if (arg == "--threads" && hasValue) threads = std::atoi(argv[++i]);
+        else if (arg == "--table-mb" && hasValue) tableMB = size_t(std::atol(argv[++i]));
+        else ok = false;
+        if (!ok) {
+            PrintTASUsage();
+            return 1;
+        }
+    }
+    if ((!hasGoal && scoreAddrs.empty()) || hold < 1 || maxFrames < 1 || beamWidth < 1) {
+        PrintTASUsage();
+        return 1;
+    }
+    if (alphabet.empty()) alphabet.push_back(0);
+
+    // the starting point: power on, or where the movie ends
+    auto start = std::make_unique<Console>();
+    start->apu.SetTimingOnly(true, 0);
+    start->LoadCartridge(cart.rom, cart.ppu.VerticalMirror, nullptr);
+    MoviePlayer movie;
+    if (!moviePath.empty() && (!movie.Open(moviePath, *start) || !movie.Seek(*start, movie.Frames()))) return 1;
+
+    auto Score = [&](const Console& nes) {
+        uint64_t s = 0;
+        for (uint16_t addr : scoreAddrs) s = s << 8 | ReadRAM(nes, addr);
+        return minimize ? ~s : s;
+    };
+
+    struct Node {
+        PooledConsole nes;
+        uint64_t hash = 0;
+        uint64_t score = 0;
+        long goalFrame = -1; // within the hold, 1 based, when the goal was met
+    };
+    // how each kept state came about: its parent in the step before, the input
+    struct Step {
+        uint32_t parent;
+        uint8_t input;
+    };
+
+    ConsolePool consoles;
+    WorkerPool pool(unsigned(std::max(0, threads)));
+    TranspositionTable seen(tableMB << 20);
+    const size_t A = alphabet.size();
+
+    std::vector<Node> beam(1);
+    beam[0].nes = start->clone(&consoles);
+    beam[0].hash = start->Hash();
+    beam[0].score = Score(*start);
+    seen.Visit(beam[0].hash);
+
+    std::vector<std::vector<Step>> history;
+    // the answer: steps taken, which state of the last one, frames of its hold used
+    long bestSteps = 0, bestIndex = 0, bestHold = 0;
+    uint64_t bestScore = beam[0].score;
+    bool reached = hasGoal && Holds(goal, *start);
+
+    for (long step = 0; !reached && (step + 1) * hold <= maxFrames && !beam.empty(); step++) {
+        std::vector<Node> children(beam.size() * A);
+        pool.Run(children.size(), [&](size_t i) {
+            Node& c = children[i];
+            c.nes = beam[i / A].nes->clone(&consoles);
+            Console& nes = *c.nes;
+            for (long f = 1; f <= hold; f++) {
+                nes.controllers[0].state = alphabet[i % A];
+                nes.controllers[1].state = 0;
+                nes.cpu.RunFrame();
+                if (nes.cpu.Halted) {
+                    c.nes.reset();
+                    return;
+                }
+                if (hasGoal && Holds(goal, nes)) {
+                    c.goalFrame = f;
+                    break;
+                }
+            }
+            c.hash = nes.Hash();
+            c.score = Score(nes);
+        });
+
+        // kept in a fixed order whatever the threads did, so a run can be repeated.
+        // equal scores go by hash, which spreads the beam when nothing scores
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < children.size(); i++) {
+            if (children[i].nes) order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            const Node& x = children[a];
+            const Node& y = children[b];
+            if (hasGoal && (x.goalFrame > 0) != (y.goalFrame > 0)) return x.goalFrame > 0;
+            if (hasGoal && x.goalFrame != y.goalFrame) return x.goalFrame < y.goalFrame;
+            if (x.score != y.score) return x.score > y.score;
+            if (x.hash != y.hash) return x.hash < y.hash;
+            return a < b;
+        });
+
+        std::vector<Node> next;
+        std::vector<Step> steps;
+        for (uint32_t i : order) {
+            if (next.size() >= size_t(beamWidth)) break;
+            if (!seen.Visit(children[i].hash)) continue;
+            steps.push_back({ uint32_t(i / A), uint8_t(i % A) });
+            next.push_back(std::move(children[i]));
+        }
+        history.push_back(std::move(steps));
+        beam = std::move(next);
+        if (beam.empty()) break;
+
+        if (hasGoal && beam[0].goalFrame > 0) {
+            reached = true;
+            bestSteps = step + 1;
+            bestIndex = 0;
+            bestHold = beam[0].goalFrame;
+        } else if (!hasGoal && beam[0].score > bestScore) {
+            bestScore = beam[0].score;
+            bestSteps = step + 1;
+            bestIndex = 0;
+            bestHold = hold;
+        }
+        std::cerr << "frame " << (step + 1) * hold << ": " << beam.size() << " states, best score "
+                  << (minimize ? ~beam[0].score : beam[0].score) << "\n";
+    }
+
+    if (hasGoal && !reached) {
+        std::cerr << "Goal not reached within " << maxFrames << " frames\n";
+        return 1;
+    }
+
+    // the inputs back from the chosen state to the start
+    std::vector<uint8_t> pads;
+    for (long s = bestSteps, index = bestIndex; s > 0; s--) {
+        const Step& st = history[size_t(s - 1)][size_t(index)];
+        long frames = s == bestSteps ? bestHold : hold;
+        pads.insert(pads.begin(), size_t(frames), alphabet[st.input]);
+        index = st.parent;
+    }
+
+    // played again from the very start, recording, the starting movie first
+    auto nes = std::make_unique<Console>();
+    nes->apu.SetTimingOnly(true, 0);
+    nes->LoadCartridge(cart.rom, cart.ppu.VerticalMirror, nullptr);
+    if (movie.IsOpen() && !movie.Seek(*nes, 0)) return 1;
+    MovieWriter writer;
+    if (!writer.Open(out, *nes)) return 1;
+    while (movie.IsOpen() && movie.Apply(*nes)) {
+        writer.Record(*nes);
+        nes->cpu.RunFrame();
+    }
+    for (uint8_t pad : pads) {
+        nes->controllers[0].state = pad;
+        nes->controllers[1].state = 0;
+        writer.Record(*nes);
+        nes->cpu.RunFrame();
+    }
+    if (!writer.Close()) return 1;
+
+    std::cerr << "Wrote " << out << ": " << pads.size() << " frames searched";
+    if (hasGoal) std::cerr << ", goal " << (Holds(goal, *nes) ? "met" : "NOT met on replay");
+    if (!scoreAddrs.empty()) std::cerr << ", score " << (minimize ? ~Score(*nes) : Score(*nes));
+    std::cerr << "\n";
+    return hasGoal && !Holds(goal, *nes) ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+class Console;
+
+// `MeowNES --tas-search rom.nes ...`: looks for pad input that meets a RAM
+// objective, from power on or from the end of a movie. a beam search: every
+// kept state tries every input of the alphabet for a few frames, on all
+// cores, states reached twice are dropped, the best scoring ones go on. the
+// best input found is written out as a movie, the starting movie in front
+int RunTASSearch(const Console& cart, int argc, char** argv);
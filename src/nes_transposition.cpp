@@ -0,0 +1,163 @@
+#include "nes_transposition.hpp"
+#include "nes_console.hpp"
+#include "lz_codec.hpp"
+
+#define TT_VISIT 0xFFFFFFFFu // action of a Visit entry
+#define TT_NODE_BYTES 48     // what the index spends per entry, roughly
+
+TranspositionTable::TranspositionTable(size_t budgetBytes)
+    : shardBudget(budgetBytes / TT_SHARDS), shards(new Shard[TT_SHARDS]) {}
+
+uint64_t TranspositionTable::Key(uint64_t from, uint32_t action) {
+    // the hash is already well mixed, the action just has to move it somewhere
+    // else entirely. splitmix64's finaliser
+    uint64_t z = from ^ ((uint64_t(action) + 1) * 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static size_t EntryBytes(size_t stateBytes) {
+    return sizeof(uint64_t) * 2 + sizeof(std::vector<uint8_t>) + stateBytes + TT_NODE_BYTES;
+}
+
+void TranspositionTable::EvictOne(Shard& s) {
+    // second chance: a used entry gets its flag cleared and is passed over once
+    for (;;) {
+        if (s.hand >= s.entries.size()) s.hand = 0;
+        Entry& e = s.entries[s.hand];
+        size_t at = s.hand++;
+        if (!e.live) continue;
+        if (e.used) {
+            e.used = false;
+            continue;
+        }
+        s.index.erase(Key(e.from, e.action));
+        s.bytes -= EntryBytes(e.state.capacity());
+        e.live = false;
+        e.state = std::vector<uint8_t>();
+        s.freeEntries.push_back(uint32_t(at));
+        s.evictions++;
+        return;
+    }
+}
+
+TranspositionTable::Entry& TranspositionTable::Insert(Shard& s, uint64_t key, uint64_t from, uint32_t action,
+                                                      size_t stateBytes) {
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        // the same pair again, or another that landed on its key: take it over
+        Entry& e = s.entries[it->second];
+        s.bytes -= EntryBytes(e.state.capacity());
+        e.from = from;
+        e.action = action;
+        e.used = true;
+        e.state.clear();
+        e.state.shrink_to_fit();
+        s.bytes += EntryBytes(0);
+        return e;
+    }
+
+    while (s.bytes + EntryBytes(stateBytes) > shardBudget && s.index.size() > 0) EvictOne(s);
+
+    uint32_t at;
+    if (!s.freeEntries.empty()) {
+        at = s.freeEntries.back();
+        s.freeEntries.pop_back();
+    } else {
+        at = uint32_t(s.entries.size());
+        s.entries.emplace_back();
+    }
+    Entry& e = s.entries[at];
+    e.from = from;
+    e.action = action;
+    e.live = true;
+    e.used = true;
+    s.index.emplace(key, at);
+    s.bytes += EntryBytes(0);
+    return e;
+}
+
+bool TranspositionTable::Visit(uint64_t hash) {
+    uint64_t key = Key(hash, TT_VISIT);
+    Shard& s = ShardOf(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        Entry& e = s.entries[it->second];
+        if (e.from == hash && e.action == TT_VISIT) {
+            e.used = true;
+            s.hits++;
+            return false;
+        }
+    }
+    s.misses++;
+    Insert(s, key, hash, TT_VISIT, 0);
+    return true;
+}
+
+void TranspositionTable::Store(uint64_t from, uint32_t action, const Console& next) {
+    // packing is the slow part, it happens before any lock is taken
+    static thread_local std::vector<uint8_t> state, packed;
+    state.resize(next.StateSize());
+    next.saveState(state.data());
+    packed.clear();
+    LZCompress(state.data(), state.size(), packed);
+
+    uint64_t key = Key(from, action);
+    Shard& s = ShardOf(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Entry& e = Insert(s, key, from, action, packed.size());
+    e.state.assign(packed.begin(), packed.end());
+    s.bytes += e.state.capacity();
+}
+
+bool TranspositionTable::Find(uint64_t from, uint32_t action, Console& nes) {
+    static thread_local std::vector<uint8_t> state;
+    state.resize(nes.StateSize());
+
+    uint64_t key = Key(from, action);
+    Shard& s = ShardOf(key);
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        Entry* e = it != s.index.end() ? &s.entries[it->second] : nullptr;
+        if (!e || e->from != from || e->action != action
+            || !LZDecompress(e->state.data(), e->state.size(), state.data(), state.size())) {
+            s.misses++;
+            return false;
+        }
+        e->used = true;
+        s.hits++;
+    }
+    nes.loadState(state.data());
+    return true;
+}
+
+void TranspositionTable::Clear() {
+    for (int i = 0; i < TT_SHARDS; i++) {
+        Shard& s = shards[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.index.clear();
+        s.entries.clear();
+        s.entries.shrink_to_fit();
+        s.freeEntries.clear();
+        s.hand = 0;
+        s.bytes = 0;
+    }
+}
+
+TranspositionTable::Stats TranspositionTable::GetStats() const {
+    Stats st;
+    for (int i = 0; i < TT_SHARDS; i++) {
+        Shard& s = shards[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        st.hits += s.hits;
+        st.misses += s.misses;
+        st.evictions += s.evictions;
+        st.entries += s.index.size();
+        st.bytes += s.bytes;
+    }
+    return st;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Console;
+
+#define TT_SHARDS 64 // locked separately, so threads rarely wait on each other
+
+// what a search already knows about console states, keyed by Console::Hash().
+// Visit() tells a state seen before from a new one, Store()/Find() remember
+// where an action leads from a state so its frames needn't be run again.
+// "action" is whatever the search makes of it: a pad byte, an index into its
+// input alphabet, frames held packed in as well. states are kept LZ packed.
+// memory stays under the budget: once full, a clock hand evicts entries that
+// weren't used since it last came by. any number of threads can share one
+class TranspositionTable {
+public:
+    explicit TranspositionTable(size_t budgetBytes);
+
+    // true the first time hash comes by (or the first since it was evicted)
+    bool Visit(uint64_t hash);
+
+    // running action from the state that hashes to from ends in next
+    void Store(uint64_t from, uint32_t action, const Console& next);
+
+    // if Store saw (from, action), loads where it leads into nes. nes has to
+    // be running the same game
+    bool Find(uint64_t from, uint32_t action, Console& nes);
+
+    void Clear();
+
+    struct Stats {
+        uint64_t hits = 0, misses = 0, evictions = 0;
+        size_t entries = 0, bytes = 0;
+    };
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        uint64_t from = 0;
+        uint32_t action = 0;
+        bool live = false;
+        bool used = false;          // looked at since the clock hand passed
+        std::vector<uint8_t> state; // packed, empty for a Visit
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, uint32_t> index; // key to entry
+        std::vector<Entry> entries;
+        std::vector<uint32_t> freeEntries;
+        size_t hand = 0;
+        size_t bytes = 0;
+        uint64_t hits = 0, misses = 0, evictions = 0;
+    };
+
+    size_t shardBudget;
+    std::unique_ptr<Shard[]> shards;
+
+    static uint64_t Key(uint64_t from, uint32_t action);
+    Shard& ShardOf(uint64_t key) { return shards[key >> 58]; }
+
+    // the entry for key, made room for and filled in but for the state
+    Entry& Insert(Shard& s, uint64_t key, uint64_t from, uint32_t action, size_t stateBytes);
+    void EvictOne(Shard& s);
+};
@@ -0,0 +1,178 @@
+#include "nes_video.hpp"
+#include "nes_console.hpp"
+#include "nes_movie.hpp"
+#include "nes.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+
+// NTSC: the 236.25/11 MHz master clock, 4 to a dot, 89342 dots a frame
+#define Y4M_HEADER "YUV4MPEG2 W256 H240 F29531250:491381 Ip A1:1 C444\n"
+#define Y4M_FRAME "FRAME\n"
+
+static void PrintMovieRenderUsage() {
+    std::cerr << "usage: MeowNES --movie-render rom.nes movie.mnm [options]\n"
+              << "  --out FILE   where the video goes (default movie.y4m)\n"
+              << "  --raw        RGB24 frames back to back instead of Y4M\n"
+              << "  --jobs N     threads (default one per core)\n"
+              << "  --serial     one pass from the start, no segments\n";
+}
+
+// BT.601 studio range of every palette entry, and plain RGB for --raw
+struct VideoPalette {
+    uint8_t y[64], u[64], v[64];
+    uint8_t rgb[64][3];
+
+    VideoPalette() {
+        for (int i = 0; i < 64; i++) {
+            double r = (nesPaletteNTSC[i] >> 16) & 0xFF;
+            double g = (nesPaletteNTSC[i] >> 8) & 0xFF;
+            double b = nesPaletteNTSC[i] & 0xFF;
+            y[i] = uint8_t(std::lround(16 + (65.738 * r + 129.057 * g + 25.064 * b) / 256));
+            u[i] = uint8_t(std::lround(128 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256));
+            v[i] = uint8_t(std::lround(128 + (112.439 * r - 94.154 * g - 18.285 * b) / 256));
+            rgb[i][0] = uint8_t(r);
+            rgb[i][1] = uint8_t(g);
+            rgb[i][2] = uint8_t(b);
+        }
+    }
+};
+
+// appends the picture nes shows now, as one Y4M frame or one RGB24 frame
+static void EncodeFrame(Console& nes, const VideoPalette& pal, bool raw, std::vector<uint8_t>& out) {
+    static thread_local uint8_t indices[NES_WIDTH * NES_HEIGHT];
+    const size_t pixels = NES_WIDTH * NES_HEIGHT;
+    nes.ppu.RenderIndices(indices);
+
+    size_t at = out.size();
+    if (raw) {
+        out.resize(at + pixels * 3);
+        uint8_t* p = &out[at];
+        for (size_t i = 0; i < pixels; i++, p += 3) {
+            const uint8_t* c = pal.rgb[indices[i]];
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+        }
+        return;
+    }
+    out.insert(out.end(), Y4M_FRAME, Y4M_FRAME + sizeof(Y4M_FRAME) - 1);
+    at = out.size();
+    out.resize(at + pixels * 3);
+    uint8_t* y = &out[at];
+    uint8_t* u = y + pixels;
+    uint8_t* v = u + pixels;
+    for (size_t i = 0; i < pixels; i++) {
+        y[i] = pal.y[indices[i]];
+        u[i] = pal.u[indices[i]];
+        v[i] = pal.v[indices[i]];
+    }
+}
+
+// plays frames [first, last) of the movie, the picture after each one
+static bool RenderSegment(const Console& base, const std::string& moviePath, uint32_t first, uint32_t last,
+                          const VideoPalette& pal, bool raw, std::vector<uint8_t>& out) {
+    PooledConsole nes = base.clone();
+    MoviePlayer movie;
+    if (!movie.Open(moviePath, *nes) || !movie.Seek(*nes, first)) return false;
+    for (uint32_t f = first; f < last; f++) {
+        if (!movie.Apply(*nes)) return false;
+        nes->cpu.RunFrame();
+        EncodeFrame(*nes, pal, raw, out);
+    }
+    return true;
+}
+
+int RunMovieRender(const Console& cart, int argc, char** argv) {
+    std::string moviePath, out = "movie.y4m";
+    bool raw = false, serial = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--out" && hasValue) out = argv[++i];
+        else if (arg == "--raw") raw = true;
+        else if (arg == "--serial") serial = true;
+        else if (arg == "--jobs" && hasValue) jobs = unsigned(std::max(1, std::atoi(argv[++i])));
+        else if (arg.rfind("--", 0) == 0 || !moviePath.empty()) {
+            PrintMovieRenderUsage();
+            return 1;
+        } else moviePath = arg;
+    }
+    if (moviePath.empty()) {
+        PrintMovieRenderUsage();
+        return 1;
+    }
+
+    // what every segment starts from: this game, no sound
+    auto base = std::make_unique<Console>();
+    base->apu.SetTimingOnly(true, 0);
+    base->LoadCartridge(cart.rom, cart.ppu.VerticalMirror, nullptr);
+
+    MoviePlayer movie;
+    if (!movie.Open(moviePath, *base)) return 1;
+    const uint32_t frames = movie.Frames();
+    const uint32_t interval = serial ? std::max(frames, 1u) : movie.KeyframeInterval();
+    const uint32_t segments = (frames + interval - 1) / interval;
+    movie.Close();
+
+    std::ofstream file(out, std::ios::binary);
+    if (!file) {
+        std::cerr << "Can't write " << out << "\n";
+        return 1;
+    }
+    if (!raw) file << Y4M_HEADER;
+
+    static const VideoPalette pal;
+    auto start = std::chrono::steady_clock::now();
+
+    // workers take segments in order and each writes its own once every one
+    // before it is out, so at most one segment per thread is held in memory
+    std::atomic<uint32_t> next{0};
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+    std::condition_variable turn;
+    uint32_t written = 0;
+
+    auto worker = [&]() {
+        std::vector<uint8_t> buffer;
+        for (uint32_t s; (s = next.fetch_add(1)) < segments;) {
+            buffer.clear();
+            uint32_t first = s * interval;
+            uint32_t last = std::min(frames, first + interval);
+            bool ok = !failed && RenderSegment(*base, moviePath, first, last, pal, raw, buffer);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            turn.wait(lock, [&] { return written == s; });
+            if (!ok) failed = true;
+            if (!failed) file.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+            written++;
+            turn.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < std::min<size_t>(jobs, segments); t++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    file.close();
+    if (failed || !file) {
+        std::cerr << "Rendering " << moviePath << " to " << out << " failed\n";
+        return 1;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "wrote " << out << ": " << frames << " frames in " << segments << " segments, " << elapsed << " s, "
+              << (elapsed > 0 ? frames / NES_FPS / elapsed : 0) << "x real time on " << pool.size() + 1 << " threads\n";
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+class Console;
+
+// `MeowNES --movie-render rom.nes movie.mnm ...`: the movie's picture, every
+// frame, to a Y4M (or raw RGB) file. the movie is cut at its keyframes and
+// the pieces are played and encoded on all cores at once, then written in
+// order, so the file is the same as playing it straight through
+int RunMovieRender(const Console& cart, int argc, char** argv);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// XXH64. fast enough to run over the whole console state every frame (a few
+// hundred ns for a snapshot) and good enough that two different states
+// colliding isn't a concern. chain buffers by passing one's hash as the
+// next one's seed
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
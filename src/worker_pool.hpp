@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// threads that stay up between batches, for jobs too short to start threads
+// for every time. Run hands out indices one at a time, so uneven work evens
+// out, and the calling thread pitches in instead of sleeping
+class WorkerPool {
+public:
+    // total threads including the caller's, 0 for one per core
+    explicit WorkerPool(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < threads; i++) workers.emplace_back([this] { WorkerLoop(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t Threads() const { return workers.size() + 1; }
+
+    // fn(i) for every i in [0, n), back when all have returned
+    void Run(size_t n, const std::function<void(size_t)>& fn) {
+        if (workers.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) fn(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            count = n;
+            next = 0;
+            running = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        Work();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return running == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next{0};
+    size_t running = 0;  // workers still on the current batch
+    uint64_t generation = 0;
+    bool closing = false;
+
+    void Work() {
+        for (size_t i; (i = next.fetch_add(1)) < count;) (*job)(i);
+    }
+
+    void WorkerLoop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return closing || generation != seen; });
+            if (closing) return;
+            seen = generation;
+            lock.unlock();
+            Work();
+            lock.lock();
+            if (--running == 0) done.notify_one();
+        }
+    }
+};